@@ -0,0 +1,334 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <texpack.hpp>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+struct Options {
+    std::vector<std::filesystem::path> folders;
+    std::filesystem::path output;
+    int padding = 2;
+    int capacity = 10000;
+    int jobs = std::max<int>(std::thread::hardware_concurrency(), 1);
+    int debounce = 50;
+    size_t budget = 0;
+    bool premultiplyAlpha = false;
+    bool qoi = false;
+    bool watch = false;
+};
+
+struct Sheet {
+    std::filesystem::path folder;
+    std::string name;
+    texpack::Packer packer;
+    std::set<std::string> changes;
+    bool reload = true;
+    bool watched = true;
+};
+
+std::mutex outputMutex;
+
+void log(std::ostream& stream, const std::string& message) {
+    std::lock_guard lock(outputMutex);
+    stream << message << std::endl;
+}
+
+void usage(const char* program) {
+    std::cout << "Usage: " << program << " [options] <folder>...\n"
+        << "Packs the PNG and QOI images in each folder into a spritesheet named after the folder.\n\n"
+        << "Options:\n"
+        << "  -o, --output <dir>     Directory to write spritesheets to (default: the parent of each folder)\n"
+        << "  -p, --padding <px>     Padding between frames, in pixels (default: 2)\n"
+        << "  -s, --size <px>        Maximum width and height of a spritesheet (default: 10000)\n"
+        << "  -j, --jobs <n>         Number of folders to pack at once (default: number of cores)\n"
+        << "  -b, --budget <MiB>     Frame memory per folder before spilling to a temporary file (default: no limit)\n"
+        << "  -m, --premultiply      Premultiply the alpha channel of each image\n"
+        << "  -q, --qoi              Write QOI spritesheets instead of PNG\n"
+        << "  -w, --watch            Rebuild spritesheets whenever their folders change\n"
+        << "  -d, --debounce <ms>    Time to wait for further changes before rebuilding (default: 50)\n"
+        << "  -h, --help             Show this message" << std::endl;
+}
+
+bool isImage(const std::filesystem::path& path) {
+    auto extension = path.extension();
+    return extension == ".png" || extension == ".qoi";
+}
+
+long long elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void parallel(const std::vector<Sheet*>& sheets, int jobs, const std::function<void(Sheet&)>& task) {
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads;
+    auto count = std::min<size_t>(std::max(jobs, 1), sheets.size());
+    for (size_t i = 0; i < count; i++) {
+        threads.emplace_back([&] {
+            for (auto index = next++; index < sheets.size(); index = next++) {
+                task(*sheets[index]);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+geode::Result<> update(Sheet& sheet, const Options& options) {
+    if (sheet.reload) {
+        sheet.packer = texpack::Packer(options.capacity);
+        sheet.packer.budget(options.budget);
+        sheet.changes.clear();
+        std::error_code error;
+        for (std::filesystem::directory_iterator it(sheet.folder, error), end; !error && it != end; it.increment(error)) {
+            if (it->is_regular_file(error) && isImage(it->path())) sheet.changes.insert(it->path().filename().string());
+        }
+        if (error) {
+            sheet.changes.clear();
+            return geode::Err("Failed to read " + sheet.folder.string() + ": " + error.message());
+        }
+        sheet.reload = false;
+    }
+
+    for (auto& name : sheet.changes) {
+        auto path = sheet.folder / name;
+        std::error_code error;
+        if (std::filesystem::is_regular_file(path, error)) {
+            auto frameResult = sheet.packer.frame(name, path, options.premultiplyAlpha);
+            if (frameResult.isErr()) {
+                auto message = "Failed to add frame " + name + ": " + frameResult.unwrapErr();
+                sheet.changes.clear();
+                return geode::Err(std::move(message));
+            }
+        }
+        else {
+            std::erase_if(sheet.packer.frames(), [&name](const texpack::Frame& frame) { return frame.name == name; });
+        }
+    }
+    sheet.changes.clear();
+
+    auto packResult = sheet.packer.pack(options.padding);
+    if (packResult.isErr()) return geode::Err("Failed to pack frames: " + packResult.unwrapErr());
+
+    auto outputPath = options.output.empty() ? sheet.folder.parent_path() : options.output;
+    auto textureName = sheet.name + (options.qoi ? ".qoi" : ".png");
+    auto texturePath = outputPath / textureName;
+    auto textureResult = options.qoi ? sheet.packer.qoi(texturePath) : sheet.packer.png(texturePath);
+    if (textureResult.isErr()) return geode::Err("Failed to create texture: " + textureResult.unwrapErr());
+
+    auto plistResult = sheet.packer.plist(outputPath / (sheet.name + ".plist"), textureName, "    ");
+    if (plistResult.isErr()) return geode::Err("Failed to create PLIST: " + plistResult.unwrapErr());
+
+    return geode::Ok();
+}
+
+bool build(const std::vector<Sheet*>& sheets, const Options& options) {
+    std::atomic<bool> success = true;
+    parallel(sheets, options.jobs, [&](Sheet& sheet) {
+        auto start = std::chrono::steady_clock::now();
+        geode::Result<> result = geode::Ok();
+        try {
+            result = update(sheet, options);
+        } catch (const std::exception& e) {
+            result = geode::Err(std::string(e.what()));
+        }
+        if (result.isErr()) {
+            // Start from scratch next time, since the packer may be missing frames that failed to decode
+            sheet.reload = true;
+            success = false;
+            log(std::cerr, sheet.name + ": " + result.unwrapErr());
+        }
+        else {
+            log(std::cout, "Packed " + sheet.name + " (" + std::to_string(sheet.packer.frames().size()) + " frames) in " + std::to_string(elapsed(start)) + " ms");
+        }
+    });
+    return success;
+}
+
+#ifdef __linux__
+int watch(std::vector<Sheet>& sheets, const Options& options) {
+    auto fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to initialize inotify: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::map<int, Sheet*> watches;
+    for (auto& sheet : sheets) {
+        auto wd = inotify_add_watch(fd, sheet.folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd < 0) {
+            std::cerr << "Failed to watch " << sheet.folder.string() << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return 1;
+        }
+        watches[wd] = &sheet;
+    }
+
+    log(std::cout, "Watching " + std::to_string(sheets.size()) + " folder(s) for changes");
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    pollfd pfd = { fd, POLLIN, 0 };
+    while (true) {
+        // Block until the first change, then keep collecting until no more arrive within the debounce window
+        auto pending = false;
+        while (true) {
+            auto ready = poll(&pfd, 1, pending ? options.debounce : -1);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready < 0) {
+                std::cerr << "Failed to wait for changes: " << strerror(errno) << std::endl;
+                close(fd);
+                return 1;
+            }
+            if (ready == 0) break;
+
+            auto length = read(fd, buffer, sizeof(buffer));
+            if (length < 0 && errno == EINTR) continue;
+            if (length < 0) {
+                std::cerr << "Failed to read changes: " << strerror(errno) << std::endl;
+                close(fd);
+                return 1;
+            }
+
+            for (auto ptr = buffer; ptr < buffer + length;) {
+                auto event = reinterpret_cast<inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were dropped, so there is no telling what changed
+                    for (auto& sheet : sheets) sheet.reload = true;
+                    pending = true;
+                    continue;
+                }
+
+                auto it = watches.find(event->wd);
+                if (it != watches.end() && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) {
+                    auto sheet = it->second;
+                    log(std::cerr, sheet->name + ": " + sheet->folder.string() + " was deleted or moved, no longer watching it");
+                    inotify_rm_watch(fd, it->first);
+                    watches.erase(it);
+                    sheet->watched = false;
+                    sheet->changes.clear();
+                    continue;
+                }
+                if (it == watches.end() || event->len == 0 || (event->mask & IN_ISDIR)) continue;
+
+                std::string name(event->name);
+                if (!isImage(name)) continue;
+
+                it->second->changes.insert(std::move(name));
+                pending = true;
+            }
+
+            if (watches.empty()) {
+                std::cerr << "No folders left to watch" << std::endl;
+                close(fd);
+                return 1;
+            }
+        }
+
+        std::vector<Sheet*> changed;
+        for (auto& sheet : sheets) {
+            if (sheet.watched && (sheet.reload || !sheet.changes.empty())) changed.push_back(&sheet);
+        }
+        build(changed, options);
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    try {
+        Options options;
+
+        for (int i = 1; i < argc; i++) {
+            std::string_view arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument("Missing value for " + std::string(arg));
+                return argv[++i];
+            };
+
+            if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            }
+            else if (arg == "-o" || arg == "--output") options.output = value();
+            else if (arg == "-p" || arg == "--padding") options.padding = std::stoi(value());
+            else if (arg == "-s" || arg == "--size") options.capacity = std::stoi(value());
+            else if (arg == "-j" || arg == "--jobs") options.jobs = std::stoi(value());
+            else if (arg == "-b" || arg == "--budget") options.budget = std::stoull(value()) * 1024 * 1024;
+            else if (arg == "-d" || arg == "--debounce") options.debounce = std::stoi(value());
+            else if (arg == "-m" || arg == "--premultiply") options.premultiplyAlpha = true;
+            else if (arg == "-q" || arg == "--qoi") options.qoi = true;
+            else if (arg == "-w" || arg == "--watch") options.watch = true;
+            else if (arg.starts_with("-")) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                usage(argv[0]);
+                return 1;
+            }
+            else options.folders.emplace_back(arg);
+        }
+
+        if (options.folders.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (options.debounce < 0) {
+            std::cerr << "Debounce must not be negative" << std::endl;
+            return 1;
+        }
+
+        #ifndef __linux__
+        if (options.watch) {
+            std::cerr << "Watch mode is only supported on Linux" << std::endl;
+            return 1;
+        }
+        #endif
+
+        if (!options.output.empty()) std::filesystem::create_directories(options.output);
+
+        std::vector<Sheet> sheets;
+        sheets.reserve(options.folders.size());
+        for (auto& folder : options.folders) {
+            if (!std::filesystem::is_directory(folder)) {
+                std::cerr << "Not a folder: " << folder.string() << std::endl;
+                return 1;
+            }
+
+            auto absolute = std::filesystem::absolute(folder).lexically_normal();
+            if (!absolute.has_filename()) absolute = absolute.parent_path();
+            sheets.push_back({ absolute, absolute.filename().string(), texpack::Packer(options.capacity) });
+        }
+
+        for (auto& sheet : sheets) {
+            auto outputPath = std::filesystem::weakly_canonical(options.output.empty() ? sheet.folder.parent_path() : options.output);
+            for (auto& other : sheets) {
+                if (std::filesystem::weakly_canonical(other.folder) == outputPath) {
+                    std::cerr << "Cannot write " << sheet.name << " into " << other.folder.string() << ", which is also being packed" << std::endl;
+                    return 1;
+                }
+            }
+        }
+
+        std::vector<Sheet*> all;
+        for (auto& sheet : sheets) all.push_back(&sheet);
+        auto success = build(all, options);
+
+        #ifdef __linux__
+        if (options.watch) return watch(sheets, options);
+        #endif
+
+        return success ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
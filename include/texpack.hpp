@@ -1,8 +1,13 @@
 #ifndef TEXPACK_HPP
 #define TEXPACK_HPP
 
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <Geode/Result.hpp>
+#include <memory>
+#include <optional>
 #include <span>
 #include <vector>
 
@@ -71,6 +76,17 @@ namespace texpack {
         std::string string() const;
     };
 
+    /// A function that reads up to `size` bytes of input into `data`.
+    /// Returns the number of bytes read, which may be fewer than requested, or 0 at the end of the input.
+    using Reader = std::function<size_t(uint8_t* data, size_t size)>;
+
+    /// A function that writes `size` bytes of output from `data`.
+    /// Returns whether all of the bytes were written.
+    using Writer = std::function<bool(const uint8_t* data, size_t size)>;
+
+    struct Image;
+    struct SpillFile;
+
     /// A structure representing a frame in the texture atlas.
     struct Frame {
         std::string name;
@@ -79,6 +95,16 @@ namespace texpack {
         Size size;
         Rect rect;
         bool rotated = false;
+        /// The offset of the frame's pixel data in spillFile, if it was moved out of memory to stay within a packer's
+        /// memory budget. Spilled frames have no data in memory, and are read back when packed.
+        std::optional<uint64_t> spill;
+        /// The temporary file holding the frame's spilled pixel data, kept open for as long as any frame refers to it.
+        std::shared_ptr<SpillFile> spillFile;
+        /// The untrimmed image the frame's pixel data is read from when packed, if the image was moved into the packer.
+        /// Such frames have no data of their own, and are cropped out of the source only while compositing.
+        std::shared_ptr<const Image> source;
+        /// The position of the trimmed rectangle within the source image.
+        Point sourceOrigin;
     };
 
     /// A structure representing an image in RGBA8888 format.
@@ -86,6 +112,11 @@ namespace texpack {
         std::vector<uint8_t> data;
         uint32_t width = 0;
         uint32_t height = 0;
+        /// Whether every pixel is known to be fully opaque, such as when decoded from a PNG without any alpha.
+        bool opaque = false;
+        /// The width and height of each tile in pixels, or 0 if the pixels are stored row by row.
+        /// Tiles are stored one after another, left to right and then top to bottom, with the edge tiles padded to full size.
+        uint32_t tile = 0;
 
         Image();
         Image(std::span<const uint8_t> data, uint32_t width, uint32_t height);
@@ -95,57 +126,196 @@ namespace texpack {
 
         Image& operator=(const Image& other);
         Image& operator=(Image&& other);
+
+        /// Gets the position of a pixel in the pixel data, taking tiling into account.
+        /// @param x The x coordinate of the pixel.
+        /// @param y The y coordinate of the pixel.
+        /// @returns The offset of the pixel's first byte in the pixel data.
+        size_t offset(uint32_t x, uint32_t y) const;
+    };
+
+    /// A function that runs a task in the background, such as by queueing it on a thread pool.
+    using Executor = std::function<void(std::function<void()> task)>;
+
+    /// The stages of packing and encoding a spritesheet in the background, in order.
+    enum class Stage {
+        Packing,
+        Encoding,
+        Listing,
+        Finished
+    };
+
+    /// A token for cancelling background work, shared by every copy of it.
+    class Cancellation {
+    protected:
+        std::shared_ptr<std::atomic<bool>> m_cancelled;
+    public:
+        Cancellation() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+        /// Asks the work holding this token to stop before its next stage.
+        void cancel() { *m_cancelled = true; }
+
+        /// Checks whether cancellation has been requested.
+        /// @returns Whether cancel() has been called on any copy of this token.
+        bool cancelled() const { return *m_cancelled; }
+    };
+
+    /// A packed and encoded spritesheet.
+    struct Sheet {
+        /// The PNG data of the texture atlas.
+        std::vector<uint8_t> png;
+        /// The property list of the frames, in Zwoptex format 3.
+        std::string plist;
+    };
+
+    /// Options for packing and encoding a spritesheet in the background.
+    struct SheetOptions {
+        /// The name of the texture atlas, written to the property list.
+        std::string name;
+        /// The amount of padding to leave between frames (in pixels). (Default: 2)
+        int padding = 2;
+        /// The minimum number of identically sized frames to lay out as a grid, or 0 to disable grids. (Default: 8)
+        size_t gridMinimum = 8;
+        /// The string used for indentation in the property list. (Default: "\t")
+        std::string indent = "\t";
+        /// The executor to run on, or empty to use texpack's own thread pool.
+        Executor executor;
+        /// Called from the background thread as each stage starts, and with Stage::Finished once the sheet is ready.
+        std::function<void(Stage stage)> progress;
+        /// A token checked before each stage with work left, which ends the work with an error once cancelled.
+        Cancellation cancellation;
     };
 
     /// A class for packing frames into a texture atlas, with maximum dimensions.
     class Packer {
     protected:
+        struct Spill;
+        struct Staging;
+
         std::vector<Frame> m_frames;
         Image m_image;
         int m_capacity;
+        uint32_t m_tiles;
+        std::unique_ptr<Staging> m_staging;
+        std::unique_ptr<Spill> m_spill;
+
+        void add(Frame frame);
     public:
         Packer(int capacity = 10000);
         Packer(const Packer& other);
         Packer(Packer&& other);
+        ~Packer();
 
         Packer& operator=(const Packer& other);
         Packer& operator=(Packer&& other);
 
+        /// Sets whether frames can be added from multiple threads at once. This must not be called while frames are being added.
+        /// While enabled, added frames are staged per thread and only appear in the frame list once merged.
+        /// Staged frames replace existing frames with the same name. When several staged frames share a name, the one that
+        /// compares greatest by trimmed size, then by pixel data, is kept, regardless of which thread added it first.
+        /// @param enabled Whether to allow concurrent frame additions. Disabling merges any staged frames.
+        void concurrent(bool enabled);
+
+        /// Gets whether frames can be added from multiple threads at once.
+        /// @returns Whether concurrent frame additions are enabled.
+        bool concurrent() const { return m_staging != nullptr; }
+
+        /// Sets the maximum number of bytes of frame pixel data to keep in memory.
+        /// Frames added beyond the budget are spilled to a temporary file, and read back sequentially when packed.
+        /// @param bytes The memory budget in bytes, or 0 for no limit.
+        void budget(size_t bytes);
+
+        /// Gets the maximum number of bytes of frame pixel data to keep in memory.
+        /// @returns The memory budget in bytes, or 0 if there is no limit.
+        size_t budget() const;
+
+        /// Sets the tile size of the packed image. Tiled images are composited one row of tiles per thread,
+        /// and are written by the PNG and QOI functions the same as untiled images.
+        /// @param size The width and height of each tile in pixels, or 0 to store the packed image row by row.
+        void tiles(uint32_t size) { m_tiles = size; }
+
+        /// Gets the tile size of the packed image.
+        /// @returns The width and height of each tile in pixels, or 0 if the packed image is stored row by row.
+        uint32_t tiles() const { return m_tiles; }
+
+        /// Merges frames staged by concurrent additions into the frame list. Called automatically by pack().
+        /// Frames added by other threads while merging stay staged until the next merge.
+        /// @returns The names that were added more than once since the last merge, in alphabetical order.
+        std::vector<std::string> merge();
+
+        /// Adds an already trimmed frame to the packer, replacing any frame with the same name.
+        /// @param frame The frame, whose pixel data covers its rectangle's size in RGBA8888 format.
+        /// @returns An error if the frame's pixel data does not match its rectangle.
+        geode::Result<> frame(Frame frame);
+
         /// Adds a frame to the packer.
         /// @param name The name of the frame.
         /// @param data The pixel data of the frame, in RGBA8888 format.
         /// @param width The width of the frame.
         /// @param height The height of the frame.
-        void frame(std::string name, std::span<const uint8_t> data, uint32_t width, uint32_t height);
+        /// @param opaque Whether every pixel is known to be fully opaque, which skips trimming. (Default: false)
+        void frame(std::string name, std::span<const uint8_t> data, uint32_t width, uint32_t height, bool opaque = false);
+
+        /// Adds a frame to the packer, taking ownership of its pixel data instead of copying it.
+        /// Only the trimmed bounds are found now, and the pixels are cropped straight into the atlas when packed.
+        /// @param name The name of the frame.
+        /// @param data The pixel data of the frame, in RGBA8888 format.
+        /// @param width The width of the frame.
+        /// @param height The height of the frame.
+        /// @param opaque Whether every pixel is known to be fully opaque, which skips trimming. (Default: false)
+        void frame(std::string name, std::vector<uint8_t>&& data, uint32_t width, uint32_t height, bool opaque = false);
 
         /// Adds a frame to the packer from an RGBA8888 image.
         /// @param name The name of the frame.
         /// @param image An RGBA8888 image.
-        void frame(std::string name, const Image& image) {
-            frame(std::move(name), image.data, image.width, image.height);
-        }
+        void frame(std::string name, const Image& image);
 
-        /// Adds a frame to the packer from an input stream.
+        /// Adds a frame to the packer from an RGBA8888 image, taking ownership of it instead of copying its pixels.
+        /// Only the trimmed bounds are found now, and the pixels are cropped straight into the atlas when packed.
         /// @param name The name of the frame.
-        /// @param stream The input stream containing the PNG data.
+        /// @param image An RGBA8888 image.
+        void frame(std::string name, Image&& image);
+
+        /// Adds a frame to the packer from an input stream, detecting whether it contains PNG or QOI data.
+        /// @param name The name of the frame.
+        /// @param stream The input stream containing the PNG or QOI data.
         /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
-        /// @returns An error if the PNG data cannot be decoded.
+        /// @returns An error if the image data cannot be decoded.
         geode::Result<> frame(std::string name, std::istream& stream, bool premultiplyAlpha = false);
 
-        /// Adds a frame to the packer from PNG data.
+        /// Adds a frame to the packer from a reader, detecting whether it provides PNG or QOI data.
+        /// @param name The name of the frame.
+        /// @param reader The reader providing the PNG or QOI data.
+        /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+        /// @returns An error if the image data cannot be read or decoded.
+        geode::Result<> frame(std::string name, const Reader& reader, bool premultiplyAlpha = false);
+
+        /// Adds a frame to the packer from PNG or QOI data, detecting the format from its signature.
         /// @param name The name of the frame.
-        /// @param data The PNG data of the frame.
+        /// @param data The PNG or QOI data of the frame.
         /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
-        /// @returns An error if the PNG data cannot be decoded.
+        /// @returns An error if the image data cannot be decoded.
         geode::Result<> frame(std::string name, std::span<const uint8_t> data, bool premultiplyAlpha = false);
 
-        /// Adds a frame to the packer from a PNG file.
+        /// Adds a frame to the packer from a PNG or QOI file, detecting the format from its signature.
         /// @param name The name of the frame.
-        /// @param path The path to the PNG file.
+        /// @param path The path to the PNG or QOI file.
         /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
-        /// @returns An error if the file cannot be opened or the PNG data cannot be decoded.
+        /// @returns An error if the file cannot be opened or the image data cannot be decoded.
         geode::Result<> frame(std::string name, const std::filesystem::path& path, bool premultiplyAlpha = false);
 
+        /// Adds every frame of an existing texture atlas to the packer, without trimming them again.
+        /// @param plist The property list of the atlas, in Zwoptex format 3.
+        /// @param image The RGBA8888 image of the atlas.
+        /// @returns An error if the property list cannot be parsed or does not match the image.
+        geode::Result<> atlas(std::string_view plist, const Image& image);
+
+        /// Adds every frame of an existing texture atlas to the packer, without trimming them again.
+        /// @param path The path to the property list of the atlas, in Zwoptex format 3, next to its PNG or QOI image.
+        /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+        /// @returns An error if the files cannot be opened, parsed or decoded.
+        geode::Result<> atlas(const std::filesystem::path& path, bool premultiplyAlpha = false);
+
         /// Gets a frame from the packer by its name.
         /// @param name The name of the frame.
         /// @returns A reference to the frame, or an error if the frame is not found.
@@ -173,9 +343,17 @@ namespace texpack {
         const Image& image() const { return m_image; }
 
         /// Finalizes the packing process, arranging the frames into a texture atlas.
+        /// Frames sharing the same trimmed size, such as animation sequences, are laid out together as a grid.
         /// @param padding The amount of padding to leave between frames (in pixels). (Default: 2)
+        /// @param gridMinimum The minimum number of identically sized frames to lay out as a grid, or 0 to disable grids. (Default: 8)
         /// @returns An error if the packing process fails.
-        geode::Result<> pack(int padding = 2);
+        geode::Result<> pack(int padding = 2, size_t gridMinimum = 8);
+
+        /// Packs the frames and encodes the spritesheet in the background, without blocking the calling thread.
+        /// The packer must outlive the work, and must not be used until the returned future is ready.
+        /// @param options The options for packing and encoding the spritesheet.
+        /// @returns A future for the PNG data and property list, or an error if packing or encoding fails or the work is cancelled.
+        std::future<geode::Result<Sheet>> packAsync(SheetOptions options);
 
         /// Saves a property list representation of the frames to an output stream.
         /// @param stream The output stream where the property list will be saved.
@@ -201,6 +379,11 @@ namespace texpack {
         /// @returns An error if the encoding fails or the stream cannot be written to.
         geode::Result<> png(std::ostream& stream) const;
 
+        /// Saves a PNG representation of the packed frames to a writer.
+        /// @param writer The writer that receives the PNG data as it is encoded.
+        /// @returns An error if the encoding fails or the writer fails.
+        geode::Result<> png(const Writer& writer) const;
+
         /// Generates a PNG representation of the packed frames.
         /// @returns A vector of bytes containing the PNG data, or an error if the encoding fails.
         geode::Result<std::vector<uint8_t>> png() const;
@@ -209,6 +392,20 @@ namespace texpack {
         /// @param path The path to the file where the PNG will be saved.
         /// @returns An error if the encoding fails or the file cannot be opened.
         geode::Result<> png(const std::filesystem::path& path) const;
+
+        /// Saves a QOI representation of the packed frames to an output stream.
+        /// @param stream The output stream where the QOI will be saved.
+        /// @returns An error if the encoding fails or the stream cannot be written to.
+        geode::Result<> qoi(std::ostream& stream) const;
+
+        /// Generates a QOI representation of the packed frames.
+        /// @returns A vector of bytes containing the QOI data, or an error if the encoding fails.
+        geode::Result<std::vector<uint8_t>> qoi() const;
+
+        /// Saves a QOI representation of the packed frames to a file.
+        /// @param path The path to the file where the QOI will be saved.
+        /// @returns An error if the encoding fails or the file cannot be opened.
+        geode::Result<> qoi(const std::filesystem::path& path) const;
     };
 
     /// Creates an RGBA8888 image from an input stream.
@@ -217,6 +414,12 @@ namespace texpack {
     /// @returns The decoded image, or an error if the decoding fails.
     geode::Result<Image> fromPNG(std::istream& stream, bool premultiplyAlpha = false);
 
+    /// Creates an RGBA8888 image from a reader, decoding the PNG data as it is read.
+    /// @param reader The reader providing the PNG data.
+    /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+    /// @returns The decoded image, or an error if the reading or decoding fails.
+    geode::Result<Image> fromPNG(const Reader& reader, bool premultiplyAlpha = false);
+
     /// Creates an RGBA8888 image from PNG data.
     /// @param data The PNG data.
     /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
@@ -241,9 +444,21 @@ namespace texpack {
     /// @param stream The output stream where the PNG will be saved.
     /// @param image An RGBA8888 image.
     /// @returns An error if the encoding fails or the stream cannot be written to.
-    inline geode::Result<> toPNG(std::ostream& stream, const Image& image) {
-        return toPNG(stream, image.data, image.width, image.height);
-    }
+    geode::Result<> toPNG(std::ostream& stream, const Image& image);
+
+    /// Saves a PNG representation of the given pixel data to a writer, as it is encoded.
+    /// @param writer The writer that receives the PNG data.
+    /// @param data The pixel data in RGBA8888 format.
+    /// @param width The width of the image.
+    /// @param height The height of the image.
+    /// @returns An error if the encoding fails or the writer fails.
+    geode::Result<> toPNG(const Writer& writer, std::span<const uint8_t> data, uint32_t width, uint32_t height);
+
+    /// Saves a PNG representation of the given image to a writer, as it is encoded.
+    /// @param writer The writer that receives the PNG data.
+    /// @param image An RGBA8888 image.
+    /// @returns An error if the encoding fails or the writer fails.
+    geode::Result<> toPNG(const Writer& writer, const Image& image);
 
     /// Creates a PNG representation of the given pixel data.
     /// @param data The pixel data in RGBA8888 format.
@@ -255,9 +470,7 @@ namespace texpack {
     /// Creates a PNG representation of the given imagw.
     /// @param image An RGBA8888 image.
     /// @returns A vector of bytes containing the PNG data, or an error if the encoding fails.
-    inline geode::Result<std::vector<uint8_t>> toPNG(const Image& image) {
-        return toPNG(image.data, image.width, image.height);
-    }
+    geode::Result<std::vector<uint8_t>> toPNG(const Image& image);
 
     /// Saves a PNG representation of the given pixel data to a file.
     /// @param path The path to the file where the PNG will be saved.
@@ -271,9 +484,77 @@ namespace texpack {
     /// @param path The path to the file where the PNG will be saved.
     /// @param image An RGBA8888 image.
     /// @returns An error if the encoding fails or the file cannot be opened.
-    inline geode::Result<> toPNG(const std::filesystem::path& path, const Image& image) {
-        return toPNG(path, image.data, image.width, image.height);
-    }
+    geode::Result<> toPNG(const std::filesystem::path& path, const Image& image);
+
+    /// Reads the frames of a texture atlas, cropping and unrotating their pixels out of the atlas image.
+    /// @param plist The property list of the atlas, in Zwoptex format 3.
+    /// @param image The RGBA8888 image of the atlas.
+    /// @returns The frames of the atlas, or an error if the property list cannot be parsed or does not match the image.
+    geode::Result<std::vector<Frame>> fromAtlas(std::string_view plist, const Image& image);
+
+    /// Reads the frames of a texture atlas, cropping and unrotating their pixels out of the atlas image.
+    /// @param path The path to the property list of the atlas, in Zwoptex format 3, next to its PNG or QOI image.
+    /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+    /// @returns The frames of the atlas, or an error if the files cannot be opened, parsed or decoded.
+    geode::Result<std::vector<Frame>> fromAtlas(const std::filesystem::path& path, bool premultiplyAlpha = false);
+
+    /// Creates an RGBA8888 image from an input stream.
+    /// @param stream The input stream containing the QOI data.
+    /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+    /// @returns The decoded image, or an error if the decoding fails.
+    geode::Result<Image> fromQOI(std::istream& stream, bool premultiplyAlpha = false);
+
+    /// Creates an RGBA8888 image from QOI data.
+    /// @param data The QOI data.
+    /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+    /// @returns The decoded image, or an error if the decoding fails.
+    geode::Result<Image> fromQOI(std::span<const uint8_t> data, bool premultiplyAlpha = false);
+
+    /// Creates an RGBA8888 image from a QOI file.
+    /// @param path The path to the QOI file.
+    /// @param premultiplyAlpha Whether to premultiply the alpha channel. (Default: false)
+    /// @returns The decoded image, or an error if the file cannot be opened or the decoding fails.
+    geode::Result<Image> fromQOI(const std::filesystem::path& path, bool premultiplyAlpha = false);
+
+    /// Saves a QOI representation of the given pixel data to an output stream.
+    /// @param stream The output stream where the QOI will be saved.
+    /// @param data The pixel data in RGBA8888 format.
+    /// @param width The width of the image.
+    /// @param height The height of the image.
+    /// @returns An error if the encoding fails or the stream cannot be written to.
+    geode::Result<> toQOI(std::ostream& stream, std::span<const uint8_t> data, uint32_t width, uint32_t height);
+
+    /// Saves a QOI representation of the given image to an output stream.
+    /// @param stream The output stream where the QOI will be saved.
+    /// @param image An RGBA8888 image.
+    /// @returns An error if the encoding fails or the stream cannot be written to.
+    geode::Result<> toQOI(std::ostream& stream, const Image& image);
+
+    /// Creates a QOI representation of the given pixel data.
+    /// @param data The pixel data in RGBA8888 format.
+    /// @param width The width of the image.
+    /// @param height The height of the image.
+    /// @returns A vector of bytes containing the QOI data, or an error if the encoding fails.
+    geode::Result<std::vector<uint8_t>> toQOI(std::span<const uint8_t> data, uint32_t width, uint32_t height);
+
+    /// Creates a QOI representation of the given image.
+    /// @param image An RGBA8888 image.
+    /// @returns A vector of bytes containing the QOI data, or an error if the encoding fails.
+    geode::Result<std::vector<uint8_t>> toQOI(const Image& image);
+
+    /// Saves a QOI representation of the given pixel data to a file.
+    /// @param path The path to the file where the QOI will be saved.
+    /// @param data The pixel data in RGBA8888 format.
+    /// @param width The width of the image.
+    /// @param height The height of the image.
+    /// @returns An error if the encoding fails or the file cannot be opened.
+    geode::Result<> toQOI(const std::filesystem::path& path, std::span<const uint8_t> data, uint32_t width, uint32_t height);
+
+    /// Saves a QOI representation of the given image to a file.
+    /// @param path The path to the file where the QOI will be saved.
+    /// @param image An RGBA8888 image.
+    /// @returns An error if the encoding fails or the file cannot be opened.
+    geode::Result<> toQOI(const std::filesystem::path& path, const Image& image);
 }
 
 #endif
@@ -1,8 +1,15 @@
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fmt/format.h>
+#include <mutex>
 #include <pugixml.hpp>
 #include <rectpack2D/finders_interface.h>
 #include <spng.h>
 #include <texpack.hpp>
+#include <thread>
+#include <unordered_map>
 
 using namespace texpack;
 using namespace geode;
@@ -12,6 +19,12 @@ using namespace rectpack2D;
 #define GEODE_IS_WINDOWS
 #endif
 
+struct FileMapping {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    void* handle = nullptr;
+};
+
 #ifdef GEODE_IS_WINDOWS
 #define NOMINMAX
 #include <Windows.h>
@@ -111,8 +124,110 @@ Result<> writeFileFrom(const std::filesystem::path& path, void* data, size_t siz
     
     return Ok();
 }
+
+using FileHandle = HANDLE;
+const FileHandle invalidFile = INVALID_HANDLE_VALUE;
+
+Result<FileHandle> createTemporaryFile() {
+    wchar_t directory[MAX_PATH + 1];
+    if (GetTempPathW(MAX_PATH + 1, directory) == 0) {
+        return Err(fmt::format("Unable to find temporary directory: {}", formatError()));
+    }
+
+    wchar_t path[MAX_PATH + 1];
+    if (GetTempFileNameW(directory, L"tpk", 0, path) == 0) {
+        return Err(fmt::format("Unable to create temporary file: {}", formatError()));
+    }
+
+    HANDLE file = CreateFileW(
+        path,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        nullptr,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+        nullptr
+    );
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return Err(fmt::format("Unable to open temporary file: {}", formatError()));
+    }
+
+    return Ok(file);
+}
+
+void closeFile(FileHandle file) {
+    CloseHandle(file);
+}
+
+Result<> writeFileAt(FileHandle file, uint64_t offset, std::span<const uint8_t> data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset + written);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + written) >> 32);
+
+        DWORD count = 0;
+        auto chunk = static_cast<DWORD>(std::min<size_t>(data.size() - written, 1 << 30));
+        if (!WriteFile(file, data.data() + written, chunk, &count, &overlapped)) {
+            return Err(fmt::format("Unable to write file: {}", formatError()));
+        }
+        written += count;
+    }
+
+    return Ok();
+}
+
+Result<> readFileAt(FileHandle file, uint64_t offset, std::span<uint8_t> data) {
+    size_t read = 0;
+    while (read < data.size()) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset + read);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + read) >> 32);
+
+        DWORD count = 0;
+        auto chunk = static_cast<DWORD>(std::min<size_t>(data.size() - read, 1 << 30));
+        if (!ReadFile(file, data.data() + read, chunk, &count, &overlapped)) {
+            return Err(fmt::format("Unable to read file: {}", formatError()));
+        }
+        if (count == 0) return Err(fmt::format("Unable to read entire file: only read {} of {}", read, data.size()));
+        read += count;
+    }
+
+    return Ok();
+}
+
+Result<> mapFile(FileHandle file, size_t size, FileMapping& mapping) {
+    HANDLE handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!handle) {
+        return Err(fmt::format("Unable to map file: {}", formatError()));
+    }
+
+    auto view = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, size);
+    if (!view) {
+        CloseHandle(handle);
+        return Err(fmt::format("Unable to map file: {}", formatError()));
+    }
+
+    mapping.data = static_cast<const uint8_t*>(view);
+    mapping.size = size;
+    mapping.handle = handle;
+    return Ok();
+}
+
+void unmapFile(FileMapping& mapping) {
+    if (mapping.data) UnmapViewOfFile(mapping.data);
+    if (mapping.handle) CloseHandle(mapping.handle);
+    mapping = FileMapping();
+}
+
+void releaseMapped(const FileMapping& mapping, uint64_t offset, size_t size) {
+    // Clean file-backed pages are trimmed from the working set by Windows as needed
+}
 #else
 #include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -170,6 +285,84 @@ Result<> writeFileFrom(const std::filesystem::path& path, void* data, size_t siz
     
     return Ok();
 }
+
+using FileHandle = int;
+const FileHandle invalidFile = -1;
+
+Result<FileHandle> createTemporaryFile() {
+    std::error_code error;
+    auto directory = std::filesystem::temp_directory_path(error);
+    if (error) return Err(fmt::format("Unable to find temporary directory: {}", error.message()));
+
+    auto path = (directory / "texpack-XXXXXX").string();
+    int file = mkstemp(path.data());
+    if (file == -1) {
+        return Err(fmt::format("Unable to create temporary file: {}", formatError()));
+    }
+
+    // The file stays usable through its descriptor, and disappears once it is closed
+    unlink(path.c_str());
+    return Ok(file);
+}
+
+void closeFile(FileHandle file) {
+    close(file);
+}
+
+Result<> writeFileAt(FileHandle file, uint64_t offset, std::span<const uint8_t> data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t bwrite = pwrite(file, data.data() + written, data.size() - written, offset + written);
+        if (bwrite < 0) {
+            if (errno == EINTR) continue;
+            return Err(fmt::format("Unable to write file: {}", formatError()));
+        }
+        written += bwrite;
+    }
+
+    return Ok();
+}
+
+Result<> readFileAt(FileHandle file, uint64_t offset, std::span<uint8_t> data) {
+    size_t read = 0;
+    while (read < data.size()) {
+        ssize_t bread = pread(file, data.data() + read, data.size() - read, offset + read);
+        if (bread < 0) {
+            if (errno == EINTR) continue;
+            return Err(fmt::format("Unable to read file: {}", formatError()));
+        }
+        if (bread == 0) return Err(fmt::format("Unable to read entire file: only read {} of {}", read, data.size()));
+        read += bread;
+    }
+
+    return Ok();
+}
+
+Result<> mapFile(FileHandle file, size_t size, FileMapping& mapping) {
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+    if (data == MAP_FAILED) {
+        return Err(fmt::format("Unable to map file: {}", formatError()));
+    }
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    mapping.data = static_cast<const uint8_t*>(data);
+    mapping.size = size;
+    return Ok();
+}
+
+void unmapFile(FileMapping& mapping) {
+    if (mapping.data) munmap(const_cast<uint8_t*>(mapping.data), mapping.size);
+    mapping = FileMapping();
+}
+
+void releaseMapped(const FileMapping& mapping, uint64_t offset, size_t size) {
+    // Only whole pages that have been read past can be dropped, since the next range may share the last one
+    auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto begin = reinterpret_cast<uintptr_t>(mapping.data) + offset;
+    auto end = (begin + size) & ~(page - 1);
+    begin &= ~(page - 1);
+    if (end > begin) madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+}
 #endif
 
 std::string Point::string() const {
@@ -193,37 +386,455 @@ Image::Image(Image&&) = default;
 Image& Image::operator=(const Image&) = default;
 Image& Image::operator=(Image&&) = default;
 
-Packer::Packer(int capacity) : m_frames(), m_image(), m_capacity(capacity) {}
+size_t pixelOffset(uint32_t width, uint32_t tile, uint32_t x, uint32_t y) {
+    if (tile == 0) return (size_t(y) * width + x) * 4;
+
+    auto columns = (size_t(width) + tile - 1) / tile;
+    auto index = size_t(y / tile) * columns + x / tile;
+    return ((index * tile + y % tile) * tile + x % tile) * 4;
+}
+
+size_t imageSize(uint32_t width, uint32_t height, uint32_t tile) {
+    if (tile == 0) return size_t(width) * height * 4;
+    return (size_t(width) + tile - 1) / tile * ((size_t(height) + tile - 1) / tile) * tile * tile * 4;
+}
+
+size_t Image::offset(uint32_t x, uint32_t y) const {
+    return pixelOffset(width, tile, x, y);
+}
+
+void readPixels(std::span<const uint8_t> data, uint32_t width, uint32_t tile, uint32_t x, uint32_t y, uint8_t* pixels, uint32_t count) {
+    while (count > 0) {
+        auto run = tile == 0 ? count : std::min(count, tile - x % tile);
+        memcpy(pixels, data.data() + pixelOffset(width, tile, x, y), size_t(run) * 4);
+        x += run;
+        pixels += size_t(run) * 4;
+        count -= run;
+    }
+}
+
+void writePixels(Image& image, uint32_t x, uint32_t y, const uint8_t* pixels, uint32_t count) {
+    while (count > 0) {
+        auto run = image.tile == 0 ? count : std::min(count, image.tile - x % image.tile);
+        memcpy(image.data.data() + image.offset(x, y), pixels, size_t(run) * 4);
+        x += run;
+        pixels += size_t(run) * 4;
+        count -= run;
+    }
+}
+
+struct ImageRows {
+    std::span<const uint8_t> data;
+    uint32_t width;
+    uint32_t tile;
+    std::vector<uint8_t> row;
+
+    ImageRows(std::span<const uint8_t> data, uint32_t width, uint32_t tile) : data(data), width(width), tile(tile) {
+        if (tile != 0) row.resize(size_t(width) * 4);
+    }
+
+    const uint8_t* operator()(uint32_t y) {
+        if (tile == 0) return data.data() + size_t(y) * width * 4;
+        readPixels(data, width, tile, 0, y, row.data(), width);
+        return row.data();
+    }
+};
+
+struct Packer::Staging {
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::vector<Frame> frames;
+    };
+
+    std::array<Shard, 16> shards;
+
+    Staging() = default;
+    Staging(const Staging& other) {
+        for (size_t i = 0; i < shards.size(); i++) {
+            std::lock_guard lock(other.shards[i].mutex);
+            shards[i].frames = other.shards[i].frames;
+        }
+    }
+
+    void add(Frame frame) {
+        auto& shard = shards[std::hash<std::thread::id>()(std::this_thread::get_id()) % shards.size()];
+        std::lock_guard lock(shard.mutex);
+        shard.frames.push_back(std::move(frame));
+    }
+
+    std::vector<Frame> take() {
+        std::vector<Frame> frames;
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            std::move(shard.frames.begin(), shard.frames.end(), std::back_inserter(frames));
+            shard.frames.clear();
+        }
+        std::ranges::sort(frames, [](const Frame& a, const Frame& b) { return a.name < b.name; });
+        return frames;
+    }
+};
+
+void parallelFor(size_t count, const std::function<void(size_t, size_t)>& task) {
+    auto threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+    if (threadCount <= 1) {
+        if (count > 0) task(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    auto chunk = (count + threadCount - 1) / threadCount;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        threads.emplace_back(task, begin, std::min(begin + chunk, count));
+    }
+    task(0, std::min(chunk, count));
+    for (auto& thread : threads) thread.join();
+}
+
+std::vector<uint8_t> rotate(std::span<const uint8_t> data, int width, int height, bool clockwise) {
+    std::vector<uint8_t> rotated(data.size());
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            auto index = clockwise ? size_t(x) * height + height - 1 - y : size_t(width - 1 - x) * height + y;
+            memcpy(rotated.data() + index * 4, data.data() + (size_t(y) * width + x) * 4, 4);
+        }
+    }
+    return rotated;
+}
+
+size_t residentSize(const Frame& frame) {
+    return frame.source ? frame.source->data.size() : frame.data.size();
+}
+
+std::vector<uint8_t> crop(const Frame& frame) {
+    auto& source = *frame.source;
+    auto [w, h] = frame.rect.size;
+    std::vector<uint8_t> data(size_t(w) * h * 4);
+    for (int y = 0; y < h; y++) {
+        memcpy(data.data() + size_t(y) * w * 4, source.data.data() + source.offset(frame.sourceOrigin.x, frame.sourceOrigin.y + y), size_t(w) * 4);
+    }
+    return data;
+}
+
+struct texpack::SpillFile {
+    std::mutex mutex;
+    FileHandle file = invalidFile;
+    uint64_t size = 0;
+
+    ~SpillFile() {
+        if (file != invalidFile) closeFile(file);
+    }
+
+    Result<uint64_t> write(std::span<const uint8_t> data) {
+        std::lock_guard lock(mutex);
+        if (file == invalidFile) {
+            GEODE_UNWRAP_INTO(file, createTemporaryFile());
+        }
+
+        auto offset = size;
+        GEODE_UNWRAP(writeFileAt(file, offset, data));
+        size += data.size();
+        return Ok(offset);
+    }
+
+    bool contains(uint64_t offset, uint64_t length) {
+        std::lock_guard lock(mutex);
+        return file != invalidFile && offset <= size && length <= size - offset;
+    }
+
+    Result<> read(uint64_t offset, std::span<uint8_t> data) {
+        if (!contains(offset, data.size())) return Err("Spilled pixel data is outside of its spill file");
+        return readFileAt(file, offset, data);
+    }
+};
+
+size_t spilledSize(const Frame& frame) {
+    return size_t(frame.rect.size.width) * frame.rect.size.height * 4;
+}
+
+Result<std::vector<uint8_t>> readSpilled(const Frame& frame) {
+    if (!frame.spillFile) return Err(fmt::format("Frame {} has no spill file", frame.name));
+
+    std::vector<uint8_t> data(spilledSize(frame));
+    auto result = frame.spillFile->read(*frame.spill, data);
+    if (result.isErr()) return Err(fmt::format("Failed to read spilled frame {}: {}", frame.name, result.unwrapErr()));
+    return Ok(std::move(data));
+}
+
+Result<> unspill(Frame& frame) {
+    if (!frame.spill) return Ok();
+
+    GEODE_UNWRAP_INTO(auto data, readSpilled(frame));
+    // Spilled frames are never rotated in the file, unlike frames in memory
+    frame.data = frame.rotated ? rotate(data, frame.rect.size.width, frame.rect.size.height, true) : std::move(data);
+    frame.spill.reset();
+    frame.spillFile.reset();
+    return Ok();
+}
+
+struct Packer::Spill {
+    size_t budget = 0;
+    std::atomic<size_t> resident = 0;
+    std::mutex mutex;
+    std::shared_ptr<SpillFile> file = std::make_shared<SpillFile>();
+
+    std::shared_ptr<SpillFile> current() {
+        std::lock_guard lock(mutex);
+        return file;
+    }
+
+    bool reserve(size_t bytes) {
+        if (budget == 0) {
+            resident += bytes;
+            return true;
+        }
+
+        auto current = resident.load();
+        do {
+            if (current + bytes > budget) return false;
+        } while (!resident.compare_exchange_weak(current, current + bytes));
+        return true;
+    }
+
+    void release(size_t bytes) {
+        auto current = resident.load();
+        while (!resident.compare_exchange_weak(current, current - std::min(current, bytes)));
+    }
+
+    void store(Frame& frame) {
+        auto target = current();
+
+        if (frame.spill && frame.spillFile != target && unspill(frame).isErr()) return;
+        if (frame.spill || (frame.data.empty() && !frame.source) || reserve(residentSize(frame))) return;
+
+        auto data = frame.source ? crop(frame) :
+            frame.rotated ? rotate(frame.data, frame.rect.size.height, frame.rect.size.width, false) : std::move(frame.data);
+
+        auto result = target->write(data);
+        if (result.isOk()) {
+            frame.spill = result.unwrap();
+            frame.spillFile = target;
+            frame.data = std::vector<uint8_t>();
+            frame.source.reset();
+        }
+        else {
+            if (!frame.source && !frame.rotated) frame.data = std::move(data);
+            resident += residentSize(frame);
+        }
+    }
+
+    Result<> compact(std::vector<Frame>& frames) {
+        auto previous = current();
+        std::vector<Frame*> spilled;
+        uint64_t live = 0;
+        auto foreign = false;
+        for (auto& frame : frames) {
+            if (!frame.spill) continue;
+            spilled.push_back(&frame);
+            live += spilledSize(frame);
+            foreign = foreign || frame.spillFile != previous;
+        }
+
+        uint64_t size;
+        {
+            std::lock_guard lock(previous->mutex);
+            size = previous->size;
+        }
+        if (!foreign && size - live < live) return Ok();
+        if (spilled.empty() && size == 0) return Ok();
+
+        std::ranges::sort(spilled, [](const Frame* a, const Frame* b) {
+            return std::pair(a->rect.origin.y, a->rect.origin.x) < std::pair(b->rect.origin.y, b->rect.origin.x);
+        });
+
+        auto compacted = std::make_shared<SpillFile>();
+        std::vector<uint64_t> offsets;
+        offsets.reserve(spilled.size());
+        for (auto frame : spilled) {
+            GEODE_UNWRAP_INTO(auto data, readSpilled(*frame));
+            GEODE_UNWRAP_INTO(auto offset, compacted->write(data));
+            offsets.push_back(offset);
+        }
+
+        for (size_t i = 0; i < spilled.size(); i++) {
+            spilled[i]->spill = offsets[i];
+            spilled[i]->spillFile = compacted;
+        }
+
+        std::lock_guard lock(mutex);
+        file = std::move(compacted);
+        return Ok();
+    }
+};
+
+Packer::Packer(int capacity) : m_frames(), m_image(), m_capacity(capacity), m_tiles(0), m_staging(), m_spill() {}
+
+Packer::Packer(const Packer& other) :
+    m_frames(other.m_frames),
+    m_image(other.m_image),
+    m_capacity(other.m_capacity),
+    m_tiles(other.m_tiles),
+    m_staging(other.m_staging ? std::make_unique<Staging>(*other.m_staging) : nullptr),
+    m_spill() {
+    if (!other.m_spill) return;
+
+    m_spill = std::make_unique<Spill>();
+    m_spill->budget = other.m_spill->budget;
+    m_spill->file = other.m_spill->current();
+
+    for (auto& frame : m_frames) m_spill->resident += residentSize(frame);
+    if (m_staging) {
+        for (auto& shard : m_staging->shards) {
+            for (auto& frame : shard.frames) m_spill->resident += residentSize(frame);
+        }
+    }
+}
 
-Packer::Packer(const Packer&) = default;
 Packer::Packer(Packer&&) = default;
-Packer& Packer::operator=(const Packer&) = default;
+Packer::~Packer() = default;
+
+Packer& Packer::operator=(const Packer& other) {
+    if (this != &other) *this = Packer(other);
+    return *this;
+}
+
 Packer& Packer::operator=(Packer&&) = default;
 
-void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
-    auto it = std::ranges::find_if(m_frames, [&name](const Frame& frame) { return frame.name == name; });
-    if (it != m_frames.end()) m_frames.erase(it, m_frames.end());
+void Packer::concurrent(bool enabled) {
+    if (enabled && !m_staging) m_staging = std::make_unique<Staging>();
+    else if (!enabled && m_staging) {
+        merge();
+        m_staging.reset();
+    }
+}
 
-    Frame frame;
+void Packer::budget(size_t bytes) {
+    if (!m_spill) {
+        if (bytes == 0) return;
 
-    frame.name = std::move(name);
-    frame.size.width = width;
-    frame.size.height = height;
+        merge();
+        m_spill = std::make_unique<Spill>();
+        for (auto& frame : m_frames) m_spill->resident += residentSize(frame);
+    }
 
-    if (width == 0 || height == 0) {
-        frame.offset.x = 0;
-        frame.offset.y = 0;
-        frame.rect.size.width = 0;
-        frame.rect.size.height = 0;
-        frame.rotated = false;
-        m_frames.push_back(std::move(frame));
+    m_spill->budget = bytes;
+}
+
+size_t Packer::budget() const {
+    return m_spill ? m_spill->budget : 0;
+}
+
+std::vector<std::string> Packer::merge() {
+    std::vector<std::string> duplicates;
+    if (!m_staging) return duplicates;
+
+    auto staged = m_staging->take();
+    if (staged.empty()) return duplicates;
+
+    auto pixels = [](const Frame& frame) {
+        if (frame.source) return crop(frame);
+        if (!frame.spill) return frame.data;
+        auto result = readSpilled(frame);
+        return result.isOk() ? result.unwrap() : std::vector<uint8_t>();
+    };
+
+    auto precedes = [&pixels](const Frame& a, const Frame& b) {
+        auto key = [](const Frame& frame) {
+            return std::tuple(
+                frame.rect.size.width, frame.rect.size.height, frame.size.width, frame.size.height,
+                frame.offset.x, frame.offset.y, frame.rotated
+            );
+        };
+        if (key(a) != key(b)) return key(a) < key(b);
+        return pixels(a) < pixels(b);
+    };
+
+    std::vector<Frame> winners;
+    for (size_t i = 0; i < staged.size();) {
+        auto best = i;
+        auto next = i + 1;
+        for (; next < staged.size() && staged[next].name == staged[i].name; next++) {
+            if (precedes(staged[best], staged[next])) best = next;
+        }
+
+        if (next - i > 1) duplicates.push_back(staged[i].name);
+        for (auto j = i; j < next; j++) {
+            if (j != best && m_spill) m_spill->release(residentSize(staged[j]));
+        }
+        winners.push_back(std::move(staged[best]));
+        i = next;
+    }
+
+    std::erase_if(m_frames, [this, &winners](const Frame& frame) {
+        auto it = std::ranges::lower_bound(winners, frame.name, {}, &Frame::name);
+        if (it == winners.end() || it->name != frame.name) return false;
+        if (m_spill) m_spill->release(residentSize(frame));
+        return true;
+    });
+
+    m_frames.reserve(m_frames.size() + winners.size());
+    std::move(winners.begin(), winners.end(), std::back_inserter(m_frames));
+    return duplicates;
+}
+
+Result<> Packer::frame(Frame frame) {
+    auto [w, h] = frame.rect.size;
+    if (w < 0 || h < 0) return Err(fmt::format("Frame {} has a negative size", frame.name));
+
+    if (frame.spill) {
+        if (!frame.spillFile || !frame.spillFile->contains(*frame.spill, spilledSize(frame))) {
+            return Err(fmt::format("Frame {} has no spilled pixel data", frame.name));
+        }
+        if (!m_spill) GEODE_UNWRAP(unspill(frame));
+    }
+    else if (frame.source) {
+        auto& source = *frame.source;
+        if (frame.sourceOrigin.x < 0 || frame.sourceOrigin.y < 0 ||
+            int64_t(frame.sourceOrigin.x) + w > source.width || int64_t(frame.sourceOrigin.y) + h > source.height ||
+            (source.width > 0 && source.height > 0 && source.offset(source.width - 1, source.height - 1) + 4 > source.data.size())) {
+            return Err(fmt::format("Frame {} is outside of its source image", frame.name));
+        }
+    }
+    else if (frame.data.size() != size_t(w) * h * 4) {
+        return Err(fmt::format("Frame {} has {} bytes of pixel data, but its size needs {}", frame.name, frame.data.size(), size_t(w) * h * 4));
+    }
+
+    add(std::move(frame));
+    return Ok();
+}
+
+void Packer::add(Frame frame) {
+    if (m_spill) m_spill->store(frame);
+
+    if (m_staging) {
+        m_staging->add(std::move(frame));
         return;
     }
 
+    auto it = std::ranges::find_if(m_frames, [&frame](const Frame& other) { return other.name == frame.name; });
+    if (it != m_frames.end()) {
+        if (m_spill) m_spill->release(residentSize(*it));
+        m_frames.erase(it);
+    }
+
+    m_frames.push_back(std::move(frame));
+}
+
+void Packer::frame(std::string name, const Image& image) {
+    if (image.tile == 0) return frame(std::move(name), image.data, image.width, image.height, image.opaque);
+
+    std::vector<uint8_t> data(size_t(image.width) * image.height * 4);
+    for (uint32_t y = 0; y < image.height; y++) {
+        readPixels(image.data, image.width, image.tile, 0, y, data.data() + size_t(y) * image.width * 4, image.width);
+    }
+    frame(std::move(name), data, image.width, image.height, image.opaque);
+}
+
+Rect trim(std::span<const uint8_t> data, uint32_t width, uint32_t height) {
     auto left = -1;
     for (int x = 0; x < width; x++) {
         for (int y = 0; y < height; y++) {
-            if (data[(y * width + x) * 4 + 3] != 0) {
+            if (data[(size_t(y) * width + x) * 4 + 3] != 0) {
                 left = x;
                 break;
             }
@@ -235,7 +846,7 @@ void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t wid
     auto right = 0;
     for (int x = width - 1; x >= 0; x--) {
         for (int y = 0; y < height; y++) {
-            if (data[(y * width + x) * 4 + 3] != 0) {
+            if (data[(size_t(y) * width + x) * 4 + 3] != 0) {
                 right = x + 1;
                 break;
             }
@@ -249,7 +860,7 @@ void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t wid
     auto top = -1;
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            if (data[(y * width + x) * 4 + 3] != 0) {
+            if (data[(size_t(y) * width + x) * 4 + 3] != 0) {
                 top = y;
                 break;
             }
@@ -261,7 +872,7 @@ void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t wid
     auto bottom = 0;
     for (int y = height - 1; y >= 0; y--) {
         for (int x = 0; x < width; x++) {
-            if (data[(y * width + x) * 4 + 3] != 0) {
+            if (data[(size_t(y) * width + x) * 4 + 3] != 0) {
                 bottom = y + 1;
                 break;
             }
@@ -272,43 +883,370 @@ void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t wid
 
     if (top >= bottom) bottom = top + 1;
 
-    auto w = right - left;
-    auto h = bottom - top;
+    return Rect(left, top, right - left, bottom - top);
+}
+
+Point measure(Frame& frame, std::span<const uint8_t> data, uint32_t width, uint32_t height, bool opaque) {
+    frame.size.width = width;
+    frame.size.height = height;
+    frame.rotated = false;
+
+    if (width == 0 || height == 0) {
+        frame.offset.x = 0;
+        frame.offset.y = 0;
+        frame.rect.size.width = 0;
+        frame.rect.size.height = 0;
+        return Point();
+    }
+
+    auto bounds = opaque ? Rect(0u, 0u, width, height) : trim(data, width, height);
+    auto [left, top] = bounds.origin;
+    auto [w, h] = bounds.size;
     frame.offset.x = left - (width - w) / 2 - (width % 2 != w % 2);
     frame.offset.y = (height - h) / 2 + (height % 2 != h % 2) - top;
-    frame.data.resize(w * h * 4);
+    frame.rect.size = bounds.size;
+    return bounds.origin;
+}
+
+void Packer::frame(std::string name, std::span<const uint8_t> data, uint32_t width, uint32_t height, bool opaque) {
+    Frame frame;
+
+    frame.name = std::move(name);
+    auto [left, top] = measure(frame, data, width, height, opaque);
+    auto [w, h] = frame.rect.size;
 
-    for (int x = 0; x < w * 4; x++) {
+    if (uint32_t(w) == width && uint32_t(h) == height) {
+        frame.data.assign(data.begin(), data.begin() + size_t(w) * h * 4);
+    }
+    else {
+        frame.data.resize(size_t(w) * h * 4);
         for (int y = 0; y < h; y++) {
-            frame.data[y * w * 4 + x] = data[(y + top) * width * 4 + left * 4 + x];
+            memcpy(frame.data.data() + size_t(y) * w * 4, data.data() + ((size_t(top) + y) * width + left) * 4, size_t(w) * 4);
         }
     }
 
-    frame.rect.size.width = w;
-    frame.rect.size.height = h;
-    frame.rotated = false;
-
-    m_frames.push_back(std::move(frame));
+    add(std::move(frame));
 }
 
-Result<> Packer::frame(std::string name, std::istream& stream, bool premultiplyAlpha) {
-    GEODE_UNWRAP_INTO(auto image, fromPNG(stream, premultiplyAlpha));
-    frame(std::move(name), image);
-    return Ok();
+void Packer::frame(std::string name, std::vector<uint8_t>&& data, uint32_t width, uint32_t height, bool opaque) {
+    Image image(std::move(data), width, height);
+    image.opaque = opaque;
+    frame(std::move(name), std::move(image));
 }
 
-Result<> Packer::frame(std::string name, std::span<const uint8_t> data, bool premultiplyAlpha) {
-    GEODE_UNWRAP_INTO(auto image, fromPNG(data, premultiplyAlpha));
+void Packer::frame(std::string name, Image&& image) {
+    if (image.tile != 0) return frame(std::move(name), std::as_const(image));
+
+    Frame frame;
+
+    frame.name = std::move(name);
+    frame.sourceOrigin = measure(frame, image.data, image.width, image.height, image.opaque);
+    if (frame.rect.size.width > 0 && frame.rect.size.height > 0) frame.source = std::make_shared<const Image>(std::move(image));
+
+    add(std::move(frame));
+}
+
+void premultiply(std::vector<uint8_t>& image) {
+    for (size_t i = 0; i < image.size(); i += 4) {
+        auto alpha = image[i + 3] / 255.0;
+        image[i] *= alpha;
+        image[i + 1] *= alpha;
+        image[i + 2] *= alpha;
+    }
+}
+
+constexpr size_t streamBufferSize = 64 * 1024;
+
+struct BufferedReader {
+    const Reader& reader;
+    std::vector<uint8_t> buffer;
+    size_t position = 0;
+    size_t end = 0;
+
+    BufferedReader(const Reader& reader) : reader(reader), buffer(streamBufferSize) {}
+
+    std::span<const uint8_t> peek(size_t size) {
+        if (end - position < size) {
+            memmove(buffer.data(), buffer.data() + position, end - position);
+            end -= position;
+            position = 0;
+            while (end < size) {
+                auto count = reader(buffer.data() + end, buffer.size() - end);
+                if (count == 0) break;
+                end += count;
+            }
+        }
+        return std::span<const uint8_t>(buffer.data() + position, std::min(size, end - position));
+    }
+
+    bool read(uint8_t* data, size_t size) {
+        auto buffered = std::min(size, end - position);
+        if (buffered > 0) memcpy(data, buffer.data() + position, buffered);
+        position += buffered;
+        data += buffered;
+        size -= buffered;
+
+        while (size >= buffer.size()) {
+            auto count = reader(data, size);
+            if (count == 0) return false;
+            data += count;
+            size -= count;
+        }
+
+        if (size > 0) {
+            position = 0;
+            end = 0;
+            while (end < size) {
+                auto count = reader(buffer.data() + end, buffer.size() - end);
+                if (count == 0) return false;
+                end += count;
+            }
+            memcpy(data, buffer.data(), size);
+            position = size;
+        }
+
+        return true;
+    }
+
+    std::vector<uint8_t> readAll() {
+        std::vector<uint8_t> data(buffer.begin() + position, buffer.begin() + end);
+        position = end = 0;
+        while (true) {
+            auto size = data.size();
+            data.resize(size + streamBufferSize);
+            auto count = reader(data.data() + size, streamBufferSize);
+            data.resize(size + count);
+            if (count == 0) break;
+        }
+        return data;
+    }
+};
+
+struct BufferedWriter {
+    const Writer& writer;
+    std::vector<uint8_t> buffer;
+    size_t size = 0;
+
+    BufferedWriter(const Writer& writer) : writer(writer), buffer(streamBufferSize) {}
+
+    bool write(const uint8_t* data, size_t length) {
+        if (size + length > buffer.size() && !flush()) return false;
+        if (length >= buffer.size()) return writer(data, length);
+        memcpy(buffer.data() + size, data, length);
+        size += length;
+        return true;
+    }
+
+    bool flush() {
+        if (size == 0) return true;
+        auto success = writer(buffer.data(), size);
+        size = 0;
+        return success;
+    }
+};
+
+Reader streamReader(std::istream& stream) {
+    return [&stream](uint8_t* data, size_t size) {
+        stream.read(reinterpret_cast<char*>(data), size);
+        return static_cast<size_t>(stream.gcount());
+    };
+}
+
+Writer streamWriter(std::ostream& stream) {
+    return [&stream](const uint8_t* data, size_t size) {
+        stream.write(reinterpret_cast<const char*>(data), size);
+        return stream.good();
+    };
+}
+
+int readStream(spng_ctx* ctx, void* user, void* data, size_t size) {
+    return reinterpret_cast<BufferedReader*>(user)->read(reinterpret_cast<uint8_t*>(data), size) ? 0 : SPNG_IO_EOF;
+}
+
+int writeStream(spng_ctx* ctx, void* user, void* data, size_t size) {
+    return reinterpret_cast<BufferedWriter*>(user)->write(reinterpret_cast<const uint8_t*>(data), size) ? 0 : SPNG_IO_ERROR;
+}
+
+bool isPNG(std::span<const uint8_t> data) {
+    return data.size() >= 8 &&
+        data[0] == 137 && data[1] == 80 && data[2] == 78 && data[3] == 71 &&
+        data[4] == 13 && data[5] == 10 && data[6] == 26 && data[7] == 10;
+}
+
+bool isQOI(std::span<const uint8_t> data) {
+    return data.size() >= 4 && data[0] == 'q' && data[1] == 'o' && data[2] == 'i' && data[3] == 'f';
+}
+
+Result<Image> decodePNG(spng_ctx* ctx, bool premultiplyAlpha) {
+    spng_ihdr ihdr;
+    if (auto result = spng_get_ihdr(ctx, &ihdr)) {
+        return Err(fmt::format("Failed to get image header: {}", spng_strerror(result)));
+    }
+
+    spng_trns trns;
+    auto hasTransparency = spng_get_trns(ctx, &trns) == 0;
+    auto opaque = !hasTransparency &&
+        ihdr.color_type != SPNG_COLOR_TYPE_GRAYSCALE_ALPHA && ihdr.color_type != SPNG_COLOR_TYPE_TRUECOLOR_ALPHA;
+
+    auto indexed = ihdr.color_type == SPNG_COLOR_TYPE_INDEXED && ihdr.bit_depth == 8;
+    auto grayscale = ihdr.color_type == SPNG_COLOR_TYPE_GRAYSCALE && ihdr.bit_depth == 8;
+    auto format = indexed ? SPNG_FMT_PNG : grayscale ? SPNG_FMT_G8 : SPNG_FMT_RGBA8;
+
+    size_t imageSize = 0;
+    if (auto result = spng_decoded_image_size(ctx, format, &imageSize)) {
+        return Err(fmt::format("Failed to get image size: {}", spng_strerror(result)));
+    }
+
+    auto pixels = size_t(ihdr.width) * ihdr.height;
+    std::vector<uint8_t> image(std::max(imageSize, pixels * 4));
+    if (auto result = spng_decode_image(ctx, image.data(), image.size(), format, format == SPNG_FMT_RGBA8 ? SPNG_DECODE_TRNS : 0)) {
+        return Err(fmt::format("Failed to decode image: {}", spng_strerror(result)));
+    }
+
+    if (indexed) {
+        spng_plte plte;
+        if (auto result = spng_get_plte(ctx, &plte)) {
+            return Err(fmt::format("Failed to get image palette: {}", spng_strerror(result)));
+        }
+
+        uint8_t colors[256 * 4];
+        for (size_t i = 0; i < 256; i++) {
+            auto& entry = plte.entries[i];
+            auto inPalette = i < plte.n_entries;
+            colors[i * 4] = inPalette ? entry.red : 0;
+            colors[i * 4 + 1] = inPalette ? entry.green : 0;
+            colors[i * 4 + 2] = inPalette ? entry.blue : 0;
+            colors[i * 4 + 3] = hasTransparency && i < trns.n_type3_entries ? trns.type3_alpha[i] : 255;
+        }
+
+        // Back to front, so that no index is overwritten before it is read
+        for (auto i = pixels; i-- > 0;) {
+            auto index = image[i];
+            memcpy(image.data() + i * 4, colors + index * 4, 4);
+        }
+    }
+    else if (grayscale) {
+        for (auto i = pixels; i-- > 0;) {
+            auto value = image[i];
+            auto pixel = image.data() + i * 4;
+            pixel[0] = value;
+            pixel[1] = value;
+            pixel[2] = value;
+            pixel[3] = hasTransparency && value == trns.gray ? 0 : 255;
+        }
+    }
+
+    if (premultiplyAlpha && !opaque) premultiply(image);
+
+    Image result(std::move(image), ihdr.width, ihdr.height);
+    result.opaque = opaque;
+    return Ok(std::move(result));
+}
+
+Result<Image> decodePNG(BufferedReader& reader, bool premultiplyAlpha) {
+    if (!isPNG(reader.peek(8))) return Err("Invalid PNG data");
+
+    auto ctx = spng_ctx_new(0);
+    if (!ctx) return Err("Failed to create PNG context");
+
+    if (auto result = spng_set_png_stream(ctx, readStream, &reader)) {
+        spng_ctx_free(ctx);
+        return Err(fmt::format("Failed to set PNG stream: {}", spng_strerror(result)));
+    }
+
+    auto image = decodePNG(ctx, premultiplyAlpha);
+    spng_ctx_free(ctx);
+    return image;
+}
+
+Result<> encodePNG(spng_rw_fn* write, void* user, std::span<const uint8_t> data, uint32_t width, uint32_t height, uint32_t tile) {
+    if (tile != 0 && data.size() < imageSize(width, height, tile)) return Err("Not enough pixel data for image dimensions");
+
+    auto ctx = spng_ctx_new(SPNG_CTX_ENCODER);
+    if (!ctx) return Err("Failed to create PNG context");
+
+    if (auto result = spng_set_png_stream(ctx, write, user)) {
+        spng_ctx_free(ctx);
+        return Err(fmt::format("Failed to set PNG stream: {}", spng_strerror(result)));
+    }
+
+    spng_ihdr ihdr = { width, height, 8, SPNG_COLOR_TYPE_TRUECOLOR_ALPHA, 0, SPNG_FILTER_NONE, SPNG_INTERLACE_NONE };
+    if (auto result = spng_set_ihdr(ctx, &ihdr)) {
+        spng_ctx_free(ctx);
+        return Err(fmt::format("Failed to set image header: {}", spng_strerror(result)));
+    }
+
+    if (tile == 0) {
+        if (auto result = spng_encode_image(ctx, data.data(), size_t(width) * height * 4, SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE)) {
+            spng_ctx_free(ctx);
+            return Err(fmt::format("Failed to encode image: {}", spng_strerror(result)));
+        }
+    }
+    else {
+        if (auto result = spng_encode_image(ctx, nullptr, 0, SPNG_FMT_PNG, SPNG_ENCODE_PROGRESSIVE | SPNG_ENCODE_FINALIZE)) {
+            spng_ctx_free(ctx);
+            return Err(fmt::format("Failed to encode image: {}", spng_strerror(result)));
+        }
+
+        ImageRows rows(data, width, tile);
+        for (uint32_t y = 0; y < height; y++) {
+            auto result = spng_encode_row(ctx, rows(y), size_t(width) * 4);
+            if (result != 0 && (result != SPNG_EOI || y + 1 < height)) {
+                spng_ctx_free(ctx);
+                return Err(fmt::format("Failed to encode image: {}", spng_strerror(result)));
+            }
+        }
+    }
+
+    spng_ctx_free(ctx);
+    return Ok();
+}
+
+Result<Image> decodeImage(std::span<const uint8_t> data, bool premultiplyAlpha) {
+    if (isQOI(data)) return fromQOI(data, premultiplyAlpha);
+    else return fromPNG(data, premultiplyAlpha);
+}
+
+Result<Image> decodeImage(BufferedReader& reader, bool premultiplyAlpha) {
+    if (isQOI(reader.peek(4))) return fromQOI(reader.readAll(), premultiplyAlpha);
+    else return decodePNG(reader, premultiplyAlpha);
+}
+
+Result<> Packer::frame(std::string name, std::istream& stream, bool premultiplyAlpha) {
+    return frame(std::move(name), streamReader(stream), premultiplyAlpha);
+}
+
+Result<> Packer::frame(std::string name, const Reader& reader, bool premultiplyAlpha) {
+    BufferedReader buffered(reader);
+    GEODE_UNWRAP_INTO(auto image, decodeImage(buffered, premultiplyAlpha));
     frame(std::move(name), image);
     return Ok();
 }
 
-Result<> Packer::frame(std::string name, const std::filesystem::path& path, bool premultiplyAlpha) {
-    GEODE_UNWRAP_INTO(auto image, fromPNG(path, premultiplyAlpha));
+Result<> Packer::frame(std::string name, std::span<const uint8_t> data, bool premultiplyAlpha) {
+    GEODE_UNWRAP_INTO(auto image, decodeImage(data, premultiplyAlpha));
     frame(std::move(name), image);
     return Ok();
 }
 
+Result<> Packer::frame(std::string name, const std::filesystem::path& path, bool premultiplyAlpha) {
+    std::vector<uint8_t> data;
+    GEODE_UNWRAP(readFileInto(path, data));
+    return frame(std::move(name), data, premultiplyAlpha);
+}
+
+Result<> Packer::atlas(std::string_view plist, const Image& image) {
+    GEODE_UNWRAP_INTO(auto frames, fromAtlas(plist, image));
+    for (auto& frame : frames) add(std::move(frame));
+    return Ok();
+}
+
+Result<> Packer::atlas(const std::filesystem::path& path, bool premultiplyAlpha) {
+    GEODE_UNWRAP_INTO(auto frames, fromAtlas(path, premultiplyAlpha));
+    for (auto& frame : frames) add(std::move(frame));
+    return Ok();
+}
+
 Result<Frame&> Packer::frame(std::string_view name) {
     auto it = std::ranges::find_if(m_frames, [name](const Frame& frame) { return frame.name == name; });
     if (it == m_frames.end()) return Err("Frame not found");
@@ -323,74 +1261,245 @@ Result<const Frame&> Packer::frame(std::string_view name) const {
     return Ok(*it);
 }
 
-Result<> Packer::pack(int padding) {
+struct Block {
+    size_t begin;
+    size_t end;
+    int columns;
+};
+
+int gridColumns(size_t count, int cellWidth, int cellHeight, int capacity) {
+    if (cellWidth <= 0 || cellHeight <= 0) return 0;
+
+    auto maxColumns = std::min<int64_t>(count, capacity / cellWidth);
+    if (maxColumns <= 0) return 0;
+
+    auto ideal = std::llround(std::sqrt(double(count) * cellHeight / cellWidth));
+    auto best = 0;
+    int64_t bestArea = 0;
+    for (auto offset = -2; offset <= 2; offset++) {
+        auto columns = std::clamp<int64_t>(ideal + offset, 1, maxColumns);
+        auto rows = (int64_t(count) + columns - 1) / columns;
+        if (rows * cellHeight > capacity) continue;
+
+        auto area = columns * cellWidth * rows * cellHeight;
+        if (best == 0 || area < bestArea) {
+            best = columns;
+            bestArea = area;
+        }
+    }
+    return best;
+}
+
+void groupFrames(
+    const std::vector<Frame>& frames, size_t gridMinimum, int padding, int capacity, std::vector<size_t>& order, std::vector<Block>& blocks
+) {
+    order.clear();
+    blocks.clear();
+
+    std::unordered_map<uint64_t, std::vector<size_t>> groups;
+    if (gridMinimum > 0) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto [w, h] = frames[i].rect.size;
+            groups[(uint64_t(uint32_t(w)) << 32) | uint32_t(h)].push_back(i);
+        }
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        auto [w, h] = frames[i].rect.size;
+        auto it = groups.find((uint64_t(uint32_t(w)) << 32) | uint32_t(h));
+        if (it != groups.end() && it->second.size() >= gridMinimum) {
+            if (it->second.front() != i) continue;
+            if (auto columns = gridColumns(it->second.size(), w + padding * 2, h + padding * 2, capacity)) {
+                blocks.push_back({ order.size(), order.size() + it->second.size(), columns });
+                order.insert(order.end(), it->second.begin(), it->second.end());
+                continue;
+            }
+
+            for (auto index : it->second) {
+                blocks.push_back({ order.size(), order.size() + 1, 1 });
+                order.push_back(index);
+            }
+            continue;
+        }
+
+        blocks.push_back({ order.size(), order.size() + 1, 1 });
+        order.push_back(i);
+    }
+}
+
+void blit(Image& image, const Frame& frame, const uint8_t* pixels, size_t stride, bool rotate, int top, int bottom) {
+    auto [l, t] = frame.rect.origin;
+    auto [w, h] = frame.rect.size;
+    if (rotate) {
+        // Rotated frames are placed a quarter turn clockwise, so each atlas row is a column of the frame
+        for (auto x = std::max(top - t, 0); x < std::min(bottom - t, w); x++) {
+            for (int y = 0; y < h; y++) {
+                memcpy(image.data.data() + image.offset(l + h - 1 - y, t + x), pixels + (size_t(y) * stride + x) * 4, 4);
+            }
+        }
+    }
+    else {
+        auto width = frame.rotated ? h : w;
+        auto height = frame.rotated ? w : h;
+        for (auto y = std::max(top - t, 0); y < std::min(bottom - t, height); y++) {
+            writePixels(image, l, t + y, pixels + size_t(y) * stride * 4, width);
+        }
+    }
+}
+
+Result<> Packer::pack(int padding, size_t gridMinimum) {
+    merge();
+
     if (m_frames.empty()) return Ok();
 
+    for (auto& frame : m_frames) {
+        if (!frame.rotated) continue;
+        if (!frame.spill && !frame.source) frame.data = rotate(frame.data, frame.rect.size.height, frame.rect.size.width, false);
+        frame.rotated = false;
+    }
+
+    for (auto& frame : m_frames) {
+        if (!frame.spill) continue;
+        if (!m_spill) {
+            GEODE_UNWRAP(unspill(frame));
+        }
+        else if (!frame.spillFile || !frame.spillFile->contains(*frame.spill, spilledSize(frame))) {
+            return Err(fmt::format("Frame {} has no spilled pixel data", frame.name));
+        }
+    }
+
+    if (m_spill) {
+        size_t resident = 0;
+        for (auto& frame : m_frames) resident += residentSize(frame);
+        m_spill->resident = resident;
+    }
+
     std::ranges::sort(m_frames, [](const Frame& a, const Frame& b) {
         return a.name < b.name;
     });
 
+    std::vector<size_t> order;
+    std::vector<Block> blocks;
     std::vector<rect_xywhf> rects;
-    rects.reserve(m_frames.size());
     auto doublePadding = padding * 2;
-    for (auto& frame : m_frames) {
-        rects.emplace_back(0, 0, frame.rect.size.width + doublePadding, frame.rect.size.height + doublePadding, false);
-    }
-
     auto index = 0;
     auto success = true;
-    auto result = find_best_packing<empty_spaces<true>>(rects, make_finder_input(
-        m_capacity, 1,
-        [&index](auto&) {
-            index++;
-            return callback_result::CONTINUE_PACKING;
-        },
-        [&success](auto&) {
-            success = false;
-            return callback_result::ABORT_PACKING;
-        },
-        flipping_option::ENABLED
-    ));
-
-    if (!success) return Err(fmt::format("Packing failed on {}", m_frames[index].name));
+    rect_wh result;
+    while (true) {
+        groupFrames(m_frames, gridMinimum, padding, m_capacity, order, blocks);
+
+        rects.clear();
+        rects.reserve(blocks.size());
+        for (auto& block : blocks) {
+            auto& size = m_frames[order[block.begin]].rect.size;
+            auto rows = (int(block.end - block.begin) + block.columns - 1) / block.columns;
+            rects.emplace_back(0, 0, (size.width + doublePadding) * block.columns, (size.height + doublePadding) * rows, false);
+        }
+
+        index = 0;
+        success = true;
+        result = find_best_packing<empty_spaces<true>>(rects, make_finder_input(
+            m_capacity, 1,
+            [&index](auto&) {
+                index++;
+                return callback_result::CONTINUE_PACKING;
+            },
+            [&success](auto&) {
+                success = false;
+                return callback_result::ABORT_PACKING;
+            },
+            flipping_option::ENABLED
+        ));
+
+        // A large grid can fail to fit where its frames would fit individually, so try again without grids
+        if ((!success || result.w <= 0 || result.h <= 0) && blocks.size() < m_frames.size()) {
+            gridMinimum = 0;
+            continue;
+        }
+        break;
+    }
+
+    if (!success) return Err(fmt::format("Packing failed on {}", m_frames[order[blocks[index].begin]].name));
     else if (result.w <= 0 || result.h <= 0) return Err("Packing failed");
 
-    for (int i = 0; i < rects.size(); i++) {
-        auto& frame = m_frames[i];
+    for (size_t i = 0; i < blocks.size(); i++) {
+        auto& block = blocks[i];
         auto& rect = rects[i];
-        frame.rect.origin.x = rect.x + padding;
-        frame.rect.origin.y = rect.y + padding;
-        frame.rotated = rect.flipped;
-
-        if (frame.rotated) {
-            std::vector<uint8_t> original(frame.data.size());
-            frame.data.swap(original);
-            auto [w, h] = frame.rect.size;
-            for (int x = 0; x < w * 4; x++) {
-                for (int y = h - 1; y >= 0; y--) {
-                    frame.data[(x / 4 * h + h - 1 - y) * 4 + x % 4] = original[y * w * 4 + x];
-                }
-            }
+        for (auto j = block.begin; j < block.end; j++) {
+            auto& frame = m_frames[order[j]];
+            auto column = int(j - block.begin) % block.columns;
+            auto row = int(j - block.begin) / block.columns;
+            auto cellWidth = frame.rect.size.width + doublePadding;
+            auto cellHeight = frame.rect.size.height + doublePadding;
+
+            frame.rect.origin.x = rect.x + (rect.flipped ? row * cellHeight : column * cellWidth) + padding;
+            frame.rect.origin.y = rect.y + (rect.flipped ? column * cellWidth : row * cellHeight) + padding;
+            frame.rotated = rect.flipped;
+
+            if (frame.rotated && !frame.spill && !frame.source) frame.data = rotate(frame.data, frame.rect.size.width, frame.rect.size.height, true);
         }
     }
 
-    auto& data = m_image.data;
-    data.clear();
-    data.resize(result.w * result.h * 4);
-    for (auto& frame : m_frames) {
-        auto [l, t] = frame.rect.origin;
-        auto w = frame.rotated ? frame.rect.size.height : frame.rect.size.width;
-        auto h = frame.rotated ? frame.rect.size.width : frame.rect.size.height;
-        auto& frameData = frame.data;
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w * 4; x++) {
-                data[(t + y) * result.w * 4 + l * 4 + x] = frameData[y * w * 4 + x];
-            }
-        }
+    FileMapping mapping;
+    std::shared_ptr<SpillFile> spillFile;
+    if (m_spill) {
+        GEODE_UNWRAP(m_spill->compact(m_frames));
+
+        spillFile = m_spill->current();
+        std::lock_guard lock(spillFile->mutex);
+        if (spillFile->size > 0) GEODE_UNWRAP(mapFile(spillFile->file, spillFile->size, mapping));
     }
 
     m_image.width = result.w;
     m_image.height = result.h;
+    m_image.tile = m_tiles;
+    m_image.data.clear();
+    m_image.data.resize(imageSize(result.w, result.h, m_tiles));
+
+    // Each band of rows (one row of tiles when tiled) is composited by a single thread, so no two threads write to the same memory
+    auto bandHeight = m_tiles == 0 ? 64 : int(m_tiles);
+    std::vector<std::vector<Frame*>> bands((result.h + bandHeight - 1) / bandHeight);
+    std::vector<Frame*> spilled;
+    for (auto& frame : m_frames) {
+        if (frame.spill) {
+            spilled.push_back(&frame);
+            continue;
+        }
+
+        auto top = frame.rect.origin.y;
+        auto bottom = top + (frame.rotated ? frame.rect.size.width : frame.rect.size.height);
+        for (auto band = top / bandHeight; band * bandHeight < bottom; band++) bands[band].push_back(&frame);
+    }
+
+    parallelFor(bands.size(), [this, &bands, bandHeight](size_t begin, size_t end) {
+        for (auto band = begin; band < end; band++) {
+            auto bandTop = int(band) * bandHeight;
+            for (auto frame : bands[band]) {
+                if (frame->source) {
+                    auto& source = *frame->source;
+                    auto pixels = source.data.data() + source.offset(frame->sourceOrigin.x, frame->sourceOrigin.y);
+                    blit(m_image, *frame, pixels, source.width, frame->rotated, bandTop, bandTop + bandHeight);
+                }
+                else {
+                    auto width = frame->rotated ? frame->rect.size.height : frame->rect.size.width;
+                    blit(m_image, *frame, frame->data.data(), width, false, bandTop, bandTop + bandHeight);
+                }
+            }
+        }
+    });
+
+    std::ranges::sort(spilled, [](const Frame* a, const Frame* b) { return *a->spill < *b->spill; });
+    for (auto frame : spilled) {
+        auto length = spilledSize(*frame);
+        if (frame->spillFile != spillFile || !mapping.data || *frame->spill > mapping.size || length > mapping.size - *frame->spill) {
+            unmapFile(mapping);
+            return Err(fmt::format("Frame {} has no spilled pixel data", frame->name));
+        }
+
+        blit(m_image, *frame, mapping.data + *frame->spill, frame->rect.size.width, frame->rotated, 0, result.h);
+        releaseMapped(mapping, *frame->spill, length);
+    }
+    unmapFile(mapping);
 
     return Ok();
 }
@@ -408,6 +1517,126 @@ struct xml_string_writer : pugi::xml_writer {
     }
 };
 
+pugi::xml_node plistValue(pugi::xml_node dict, std::string_view key) {
+    for (auto node = dict.first_child(); node; node = node.next_sibling()) {
+        if (std::string_view(node.name()) == "key" && node.child_value() == key) return node.next_sibling();
+    }
+    return pugi::xml_node();
+}
+
+bool plistNumbers(pugi::xml_node node, std::span<int> numbers) {
+    size_t count = 0;
+    auto text = node.child_value();
+    while (*text) {
+        if (*text == '-' || *text == '.' || (*text >= '0' && *text <= '9')) {
+            if (count >= numbers.size()) return false;
+            char* end = nullptr;
+            numbers[count++] = std::lround(std::strtod(text, &end));
+            if (end == text) return false;
+            text = end;
+        }
+        else {
+            text++;
+        }
+    }
+    return count == numbers.size();
+}
+
+Result<std::vector<Frame>> readAtlas(pugi::xml_node root, const Image& image) {
+    auto metadata = plistValue(root, "metadata");
+    if (auto format = plistValue(metadata, "format").text().as_int(); format != 3) {
+        return Err(fmt::format("Unsupported property list format: {}", format));
+    }
+
+    std::vector<Frame> frames;
+    auto framesNode = plistValue(root, "frames");
+    for (auto key = framesNode.first_child(); key; key = key.next_sibling()) {
+        if (std::string_view(key.name()) != "key") continue;
+        auto node = key.next_sibling();
+
+        Frame frame;
+        frame.name = key.child_value();
+
+        int offset[2], size[2], sourceSize[2], rect[4];
+        if (
+            !plistNumbers(plistValue(node, "spriteOffset"), offset) ||
+            !plistNumbers(plistValue(node, "spriteSize"), size) ||
+            !plistNumbers(plistValue(node, "spriteSourceSize"), sourceSize) ||
+            !plistNumbers(plistValue(node, "textureRect"), rect)
+        ) return Err(fmt::format("Invalid geometry for frame {}", frame.name));
+
+        auto rotated = std::string_view(plistValue(node, "textureRotated").name()) == "true";
+        auto width = rotated ? size[1] : size[0];
+        auto height = rotated ? size[0] : size[1];
+        if (
+            size[0] < 0 || size[1] < 0 || rect[0] < 0 || rect[1] < 0 ||
+            int64_t(rect[0]) + width > int64_t(image.width) || int64_t(rect[1]) + height > int64_t(image.height)
+        ) return Err(fmt::format("Frame {} is outside of the atlas image", frame.name));
+        if (sourceSize[0] < 0 || sourceSize[1] < 0) return Err(fmt::format("Frame {} has a negative source size", frame.name));
+
+        frame.offset = Point(offset[0], offset[1]);
+        frame.size = Size(sourceSize[0], sourceSize[1]);
+        frame.rect = Rect(rect[0], rect[1], size[0], size[1]);
+        frame.rotated = rotated;
+        frames.push_back(std::move(frame));
+    }
+
+    parallelFor(frames.size(), [&frames, &image](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+            auto& frame = frames[i];
+            auto [l, t] = frame.rect.origin;
+            auto [w, h] = frame.rect.size;
+            frame.data.resize(size_t(w) * h * 4);
+
+            if (frame.rotated) {
+                for (int y = 0; y < h; y++) {
+                    for (int x = 0; x < w; x++) {
+                        memcpy(frame.data.data() + (size_t(y) * w + x) * 4, image.data.data() + image.offset(l + h - 1 - y, t + x), 4);
+                    }
+                }
+                frame.rotated = false;
+            }
+            else {
+                for (int y = 0; y < h; y++) {
+                    readPixels(image.data, image.width, image.tile, l, t + y, frame.data.data() + size_t(y) * w * 4, w);
+                }
+            }
+        }
+    });
+
+    return Ok(std::move(frames));
+}
+
+Result<std::vector<Frame>> texpack::fromAtlas(std::string_view plist, const Image& image) {
+    pugi::xml_document doc;
+    if (auto result = doc.load_buffer(plist.data(), plist.size()); !result) {
+        return Err(fmt::format("Failed to parse property list: {}", result.description()));
+    }
+
+    return readAtlas(doc.child("plist").child("dict"), image);
+}
+
+Result<std::vector<Frame>> texpack::fromAtlas(const std::filesystem::path& path, bool premultiplyAlpha) {
+    std::vector<uint8_t> plist;
+    GEODE_UNWRAP(readFileInto(path, plist));
+
+    pugi::xml_document doc;
+    if (auto result = doc.load_buffer(plist.data(), plist.size()); !result) {
+        return Err(fmt::format("Failed to parse property list: {}", result.description()));
+    }
+
+    auto root = doc.child("plist").child("dict");
+    auto metadata = plistValue(root, "metadata");
+    std::string textureName = plistValue(metadata, "textureFileName").child_value();
+    if (textureName.empty()) textureName = plistValue(metadata, "realTextureFileName").child_value();
+    if (textureName.empty()) return Err("Property list does not name its texture");
+
+    std::vector<uint8_t> texture;
+    GEODE_UNWRAP(readFileInto(path.parent_path() / textureName, texture));
+    GEODE_UNWRAP_INTO(auto image, decodeImage(texture, premultiplyAlpha));
+    return readAtlas(root, image);
+}
+
 std::string Packer::plist(std::string_view name, std::string_view indent) const {
     pugi::xml_document doc;
     auto root = doc.append_child("plist");
@@ -456,6 +1685,10 @@ Result<> Packer::png(std::ostream& stream) const {
     return toPNG(stream, m_image);
 }
 
+Result<> Packer::png(const Writer& writer) const {
+    return toPNG(writer, m_image);
+}
+
 Result<std::vector<uint8_t>> Packer::png() const {
     return toPNG(m_image);
 }
@@ -464,55 +1697,132 @@ Result<> Packer::png(const std::filesystem::path& path) const {
     return toPNG(path, m_image);
 }
 
-Result<Image> texpack::fromPNG(std::istream& stream, bool premultiplyAlpha) {
-    return fromPNG(std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()), premultiplyAlpha);
+Result<> Packer::qoi(std::ostream& stream) const {
+    return toQOI(stream, m_image);
 }
 
-Result<Image> texpack::fromPNG(std::span<const uint8_t> data, bool premultiplyAlpha) {
-    if (
-        data.size() < 8 ||
-        data[0] != 137 || data[1] != 80 || data[2] != 78 || data[3] != 71 ||
-        data[4] != 13 || data[5] != 10 || data[6] != 26 || data[7] != 10
-    ) return Err("Invalid PNG data");
+Result<std::vector<uint8_t>> Packer::qoi() const {
+    return toQOI(m_image);
+}
 
-    auto ctx = spng_ctx_new(0);
-    if (!ctx) return Err("Failed to create PNG context");
+Result<> Packer::qoi(const std::filesystem::path& path) const {
+    return toQOI(path, m_image);
+}
 
-    if (auto result = spng_set_png_buffer(ctx, data.data(), data.size())) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to set PNG buffer: {}", spng_strerror(result)));
+class ThreadPool {
+protected:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(m_mutex);
+                m_condition.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty()) return;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+public:
+    ThreadPool() {
+        auto count = std::max(std::thread::hardware_concurrency(), 1u);
+        m_threads.reserve(count);
+        for (unsigned i = 0; i < count; i++) m_threads.emplace_back(&ThreadPool::run, this);
     }
 
-    spng_ihdr ihdr;
-    if (auto result = spng_get_ihdr(ctx, &ihdr)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to get image header: {}", spng_strerror(result)));
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        for (auto& thread : m_threads) thread.join();
     }
 
-    size_t imageSize = 0;
-    if (auto result = spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &imageSize)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to get image size: {}", spng_strerror(result)));
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_condition.notify_one();
     }
 
-    std::vector<uint8_t> image(imageSize);
-    if (auto result = spng_decode_image(ctx, image.data(), imageSize, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to decode image: {}", spng_strerror(result)));
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
     }
+};
 
-    spng_ctx_free(ctx);
+Result<Sheet> packSheet(Packer& packer, const SheetOptions& options) {
+    auto stage = [&options](Stage next) -> Result<> {
+        if (options.cancellation.cancelled()) return Err("Packing was cancelled");
+        if (options.progress) options.progress(next);
+        return Ok();
+    };
+
+    GEODE_UNWRAP(stage(Stage::Packing));
+    GEODE_UNWRAP(packer.pack(options.padding, options.gridMinimum));
+
+    Sheet sheet;
+    GEODE_UNWRAP(stage(Stage::Encoding));
+    GEODE_UNWRAP_INTO(sheet.png, packer.png());
+
+    GEODE_UNWRAP(stage(Stage::Listing));
+    sheet.plist = packer.plist(std::string_view(options.name), options.indent);
 
-    if (premultiplyAlpha) {
-        for (size_t i = 0; i < image.size(); i += 4) {
-            auto alpha = image[i + 3] / 255.0;
-            image[i] *= alpha;
-            image[i + 1] *= alpha;
-            image[i + 2] *= alpha;
+    if (options.progress) options.progress(Stage::Finished);
+    return Ok(std::move(sheet));
+}
+
+std::future<Result<Sheet>> Packer::packAsync(SheetOptions options) {
+    auto promise = std::make_shared<std::promise<Result<Sheet>>>();
+    auto future = promise->get_future();
+
+    auto executor = std::move(options.executor);
+    auto task = [this, promise, options = std::move(options)] {
+        try {
+            promise->set_value(packSheet(*this, options));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
         }
+    };
+
+    if (executor) executor(std::move(task));
+    else ThreadPool::shared().submit(std::move(task));
+
+    return future;
+}
+
+Result<Image> texpack::fromPNG(std::istream& stream, bool premultiplyAlpha) {
+    return fromPNG(streamReader(stream), premultiplyAlpha);
+}
+
+Result<Image> texpack::fromPNG(const Reader& reader, bool premultiplyAlpha) {
+    BufferedReader buffered(reader);
+    return decodePNG(buffered, premultiplyAlpha);
+}
+
+Result<Image> texpack::fromPNG(std::span<const uint8_t> data, bool premultiplyAlpha) {
+    if (!isPNG(data)) return Err("Invalid PNG data");
+
+    auto ctx = spng_ctx_new(0);
+    if (!ctx) return Err("Failed to create PNG context");
+
+    if (auto result = spng_set_png_buffer(ctx, data.data(), data.size())) {
+        spng_ctx_free(ctx);
+        return Err(fmt::format("Failed to set PNG buffer: {}", spng_strerror(result)));
     }
 
-    return Ok(Image(std::move(image), ihdr.width, ihdr.height));
+    auto image = decodePNG(ctx, premultiplyAlpha);
+    spng_ctx_free(ctx);
+    return image;
 }
 
 Result<Image> texpack::fromPNG(const std::filesystem::path& path, bool premultiplyAlpha) {
@@ -522,17 +1832,31 @@ Result<Image> texpack::fromPNG(const std::filesystem::path& path, bool premultip
 }
 
 Result<> texpack::toPNG(std::ostream& stream, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
-    GEODE_UNWRAP_INTO(auto pngData, toPNG(data, width, height));
-    stream.write(reinterpret_cast<const char*>(pngData.data()), pngData.size());
+    return toPNG(streamWriter(stream), data, width, height);
+}
+
+Result<> texpack::toPNG(std::ostream& stream, const Image& image) {
+    return toPNG(streamWriter(stream), image);
+}
+
+Result<> writePNG(const Writer& writer, std::span<const uint8_t> data, uint32_t width, uint32_t height, uint32_t tile) {
+    BufferedWriter buffered(writer);
+    GEODE_UNWRAP(encodePNG(writeStream, &buffered, data, width, height, tile));
+    if (!buffered.flush()) return Err("Failed to write PNG data");
     return Ok();
 }
 
-Result<std::vector<uint8_t>> texpack::toPNG(std::span<const uint8_t> data, uint32_t width, uint32_t height) {
-    auto ctx = spng_ctx_new(SPNG_CTX_ENCODER);
-    if (!ctx) return Err("Failed to create PNG context");
+Result<> texpack::toPNG(const Writer& writer, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
+    return writePNG(writer, data, width, height, 0);
+}
+
+Result<> texpack::toPNG(const Writer& writer, const Image& image) {
+    return writePNG(writer, image.data, image.width, image.height, image.tile);
+}
 
+Result<std::vector<uint8_t>> encodePNG(std::span<const uint8_t> data, uint32_t width, uint32_t height, uint32_t tile) {
     std::vector<uint8_t> pngData;
-    if (auto result = spng_set_png_stream(ctx, [](spng_ctx* ctx, void* user, void* data, size_t size) {
+    GEODE_UNWRAP(encodePNG([](spng_ctx* ctx, void* user, void* data, size_t size) {
         auto pngData = reinterpret_cast<std::vector<uint8_t>*>(user);
         auto pngSize = pngData->size();
         pngData->resize(pngSize + size);
@@ -542,27 +1866,256 @@ Result<std::vector<uint8_t>> texpack::toPNG(std::span<const uint8_t> data, uint3
         memcpy(pngData->data() + pngSize, data, size);
         #endif
         return 0;
-    }, &pngData)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to set PNG stream: {}", spng_strerror(result)));
-    }
-
-    spng_ihdr ihdr = { width, height, 8, SPNG_COLOR_TYPE_TRUECOLOR_ALPHA, 0, SPNG_FILTER_NONE, SPNG_INTERLACE_NONE };
-    if (auto result = spng_set_ihdr(ctx, &ihdr)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to set image header: {}", spng_strerror(result)));
-    }
+    }, &pngData, data, width, height, tile));
+    return Ok(std::move(pngData));
+}
 
-    if (auto result = spng_encode_image(ctx, data.data(), width * height * 4, SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE)) {
-        spng_ctx_free(ctx);
-        return Err(fmt::format("Failed to encode image: {}", spng_strerror(result)));
-    }
+Result<std::vector<uint8_t>> texpack::toPNG(std::span<const uint8_t> data, uint32_t width, uint32_t height) {
+    return encodePNG(data, width, height, 0);
+}
 
-    spng_ctx_free(ctx);
-    return Ok(std::move(pngData));
+Result<std::vector<uint8_t>> texpack::toPNG(const Image& image) {
+    return encodePNG(image.data, image.width, image.height, image.tile);
 }
 
 Result<> texpack::toPNG(const std::filesystem::path& path, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
     GEODE_UNWRAP_INTO(auto pngData, toPNG(data, width, height));
     return writeFileFrom(path, pngData.data(), pngData.size());
 }
+
+Result<> texpack::toPNG(const std::filesystem::path& path, const Image& image) {
+    GEODE_UNWRAP_INTO(auto pngData, toPNG(image));
+    return writeFileFrom(path, pngData.data(), pngData.size());
+}
+
+uint32_t readBigEndian(const uint8_t* data) {
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+uint8_t* writeBigEndian(uint8_t* data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+    return data + 4;
+}
+
+constexpr size_t qoiHeaderSize = 14;
+constexpr uint8_t qoiPadding[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+constexpr uint8_t qoiOpIndex = 0x00;
+constexpr uint8_t qoiOpDiff = 0x40;
+constexpr uint8_t qoiOpLuma = 0x80;
+constexpr uint8_t qoiOpRun = 0xc0;
+constexpr uint8_t qoiOpRGB = 0xfe;
+constexpr uint8_t qoiOpRGBA = 0xff;
+constexpr uint8_t qoiMask = 0xc0;
+
+uint8_t qoiHash(const uint8_t* pixel) {
+    return (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+}
+
+Result<Image> texpack::fromQOI(std::istream& stream, bool premultiplyAlpha) {
+    auto reader = streamReader(stream);
+    BufferedReader buffered(reader);
+    return fromQOI(buffered.readAll(), premultiplyAlpha);
+}
+
+Result<Image> texpack::fromQOI(std::span<const uint8_t> data, bool premultiplyAlpha) {
+    if (data.size() < qoiHeaderSize + sizeof(qoiPadding) || !isQOI(data)) return Err("Invalid QOI data");
+
+    auto width = readBigEndian(data.data() + 4);
+    auto height = readBigEndian(data.data() + 8);
+    auto channels = data[12];
+    auto colorspace = data[13];
+    if (width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1) return Err("Invalid QOI header");
+
+    auto pixels = size_t(width) * height;
+    // Every pixel takes at least one byte, or a 62nd of a byte in a run, so anything larger cannot be valid data
+    if (pixels / 62 > data.size()) return Err("Invalid QOI header");
+
+    std::vector<uint8_t> image(pixels * 4);
+    uint8_t index[64 * 4] = {};
+    uint8_t pixel[4] = { 0, 0, 0, 255 };
+    auto end = data.size() - sizeof(qoiPadding);
+    size_t position = qoiHeaderSize;
+    size_t run = 0;
+    for (size_t i = 0; i < image.size(); i += 4) {
+        if (run > 0) {
+            run--;
+        }
+        else if (position < end) {
+            auto op = data[position++];
+            if (op == qoiOpRGB) {
+                if (position + 3 > end) return Err("Unexpected end of QOI data");
+                pixel[0] = data[position];
+                pixel[1] = data[position + 1];
+                pixel[2] = data[position + 2];
+                position += 3;
+            }
+            else if (op == qoiOpRGBA) {
+                if (position + 4 > end) return Err("Unexpected end of QOI data");
+                pixel[0] = data[position];
+                pixel[1] = data[position + 1];
+                pixel[2] = data[position + 2];
+                pixel[3] = data[position + 3];
+                position += 4;
+            }
+            else if ((op & qoiMask) == qoiOpIndex) {
+                memcpy(pixel, index + op * 4, 4);
+            }
+            else if ((op & qoiMask) == qoiOpDiff) {
+                pixel[0] += ((op >> 4) & 0x03) - 2;
+                pixel[1] += ((op >> 2) & 0x03) - 2;
+                pixel[2] += (op & 0x03) - 2;
+            }
+            else if ((op & qoiMask) == qoiOpLuma) {
+                if (position + 1 > end) return Err("Unexpected end of QOI data");
+                auto next = data[position++];
+                auto greenDiff = (op & 0x3f) - 32;
+                pixel[0] += greenDiff - 8 + ((next >> 4) & 0x0f);
+                pixel[1] += greenDiff;
+                pixel[2] += greenDiff - 8 + (next & 0x0f);
+            }
+            else {
+                run = op & 0x3f;
+            }
+
+            memcpy(index + qoiHash(pixel) * 4, pixel, 4);
+        }
+        else {
+            return Err("Unexpected end of QOI data");
+        }
+
+        memcpy(image.data() + i, pixel, 4);
+    }
+
+    if (premultiplyAlpha) premultiply(image);
+
+    return Ok(Image(std::move(image), width, height));
+}
+
+Result<Image> texpack::fromQOI(const std::filesystem::path& path, bool premultiplyAlpha) {
+    std::vector<uint8_t> data;
+    GEODE_UNWRAP(readFileInto(path, data));
+    return fromQOI(data, premultiplyAlpha);
+}
+
+Result<> texpack::toQOI(std::ostream& stream, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
+    GEODE_UNWRAP_INTO(auto qoiData, toQOI(data, width, height));
+    stream.write(reinterpret_cast<const char*>(qoiData.data()), qoiData.size());
+    return Ok();
+}
+
+Result<> texpack::toQOI(std::ostream& stream, const Image& image) {
+    GEODE_UNWRAP_INTO(auto qoiData, toQOI(image));
+    stream.write(reinterpret_cast<const char*>(qoiData.data()), qoiData.size());
+    return Ok();
+}
+
+Result<std::vector<uint8_t>> encodeQOI(std::span<const uint8_t> data, uint32_t width, uint32_t height, uint32_t tile) {
+    if (width == 0 || height == 0) return Err("Invalid image dimensions");
+    if (data.size() < imageSize(width, height, tile)) return Err("Not enough pixel data for image dimensions");
+
+    std::vector<uint8_t> qoiData(qoiHeaderSize);
+    auto header = qoiData.data();
+    memcpy(header, "qoif", 4);
+    writeBigEndian(writeBigEndian(header + 4, width), height);
+    header[12] = 4;
+    header[13] = 0;
+
+    uint8_t index[64 * 4] = {};
+    uint8_t previous[4] = { 0, 0, 0, 255 };
+    size_t position = qoiHeaderSize;
+    size_t run = 0;
+    ImageRows rows(data, width, tile);
+    for (uint32_t y = 0; y < height; y++) {
+        qoiData.resize(position + size_t(width) * 5 + 1);
+        auto out = qoiData.data();
+        auto row = rows(y);
+        for (uint32_t x = 0; x < width; x++) {
+            auto pixel = row + size_t(x) * 4;
+            if (memcmp(pixel, previous, 4) == 0) {
+                run++;
+                if (run == 62) {
+                    out[position++] = qoiOpRun | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                out[position++] = qoiOpRun | (run - 1);
+                run = 0;
+            }
+
+            auto hash = qoiHash(pixel);
+            if (memcmp(index + hash * 4, pixel, 4) == 0) {
+                out[position++] = qoiOpIndex | hash;
+            }
+            else {
+                memcpy(index + hash * 4, pixel, 4);
+
+                if (pixel[3] == previous[3]) {
+                    int8_t redDiff = pixel[0] - previous[0];
+                    int8_t greenDiff = pixel[1] - previous[1];
+                    int8_t blueDiff = pixel[2] - previous[2];
+                    int8_t redGreenDiff = redDiff - greenDiff;
+                    int8_t blueGreenDiff = blueDiff - greenDiff;
+
+                    if (
+                        redDiff >= -2 && redDiff <= 1 &&
+                        greenDiff >= -2 && greenDiff <= 1 &&
+                        blueDiff >= -2 && blueDiff <= 1
+                    ) {
+                        out[position++] = qoiOpDiff | ((redDiff + 2) << 4) | ((greenDiff + 2) << 2) | (blueDiff + 2);
+                    }
+                    else if (
+                        redGreenDiff >= -8 && redGreenDiff <= 7 &&
+                        greenDiff >= -32 && greenDiff <= 31 &&
+                        blueGreenDiff >= -8 && blueGreenDiff <= 7
+                    ) {
+                        out[position++] = qoiOpLuma | (greenDiff + 32);
+                        out[position++] = ((redGreenDiff + 8) << 4) | (blueGreenDiff + 8);
+                    }
+                    else {
+                        out[position++] = qoiOpRGB;
+                        memcpy(out + position, pixel, 3);
+                        position += 3;
+                    }
+                }
+                else {
+                    out[position++] = qoiOpRGBA;
+                    memcpy(out + position, pixel, 4);
+                    position += 4;
+                }
+            }
+
+            memcpy(previous, pixel, 4);
+        }
+    }
+
+    qoiData.resize(position + 1 + sizeof(qoiPadding));
+    if (run > 0) qoiData[position++] = qoiOpRun | (run - 1);
+
+    memcpy(qoiData.data() + position, qoiPadding, sizeof(qoiPadding));
+    qoiData.resize(position + sizeof(qoiPadding));
+    return Ok(std::move(qoiData));
+}
+
+Result<std::vector<uint8_t>> texpack::toQOI(std::span<const uint8_t> data, uint32_t width, uint32_t height) {
+    return encodeQOI(data, width, height, 0);
+}
+
+Result<std::vector<uint8_t>> texpack::toQOI(const Image& image) {
+    return encodeQOI(image.data, image.width, image.height, image.tile);
+}
+
+Result<> texpack::toQOI(const std::filesystem::path& path, std::span<const uint8_t> data, uint32_t width, uint32_t height) {
+    GEODE_UNWRAP_INTO(auto qoiData, toQOI(data, width, height));
+    return writeFileFrom(path, qoiData.data(), qoiData.size());
+}
+
+Result<> texpack::toQOI(const std::filesystem::path& path, const Image& image) {
+    GEODE_UNWRAP_INTO(auto qoiData, toQOI(image));
+    return writeFileFrom(path, qoiData.data(), qoiData.size());
+}
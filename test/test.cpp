@@ -1,8 +1,68 @@
+#include <algorithm>
 #include <iostream>
 #include <texpack.hpp>
 
+bool roundTripQOI(const std::string& name, const std::vector<uint8_t>& data, uint32_t width, uint32_t height) {
+    auto encodeResult = texpack::toQOI(data, width, height);
+    if (encodeResult.isErr()) {
+        std::cerr << "Failed to encode QOI " << name << ": " << encodeResult.unwrapErr() << std::endl;
+        return false;
+    }
+
+    auto decodeResult = texpack::fromQOI(encodeResult.unwrap());
+    if (decodeResult.isErr()) {
+        std::cerr << "Failed to decode QOI " << name << ": " << decodeResult.unwrapErr() << std::endl;
+        return false;
+    }
+
+    auto image = decodeResult.unwrap();
+    if (image.width != width || image.height != height || image.data != data) {
+        std::cerr << "QOI " << name << " did not round-trip" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool testQOI() {
+    auto success = true;
+
+    std::vector<uint8_t> single = { 12, 34, 56, 78 };
+    success &= roundTripQOI("single pixel", single, 1, 1);
+
+    std::vector<uint8_t> runs(100 * 3 * 4);
+    for (size_t i = 0; i < runs.size(); i += 4) {
+        auto pixel = i / 4;
+        uint8_t value = pixel < 150 ? 0 : pixel < 230 ? 200 : 17;
+        runs[i] = value;
+        runs[i + 1] = value;
+        runs[i + 2] = value;
+        runs[i + 3] = pixel < 70 ? 255 : pixel < 150 ? 0 : 128;
+    }
+    success &= roundTripQOI("runs", runs, 100, 3);
+
+    std::vector<uint8_t> mixed(37 * 29 * 4);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < mixed.size(); i += 4) {
+        seed = seed * 1664525 + 1013904223;
+        auto pixel = i / 4;
+        if (pixel > 0 && seed % 7 == 0) {
+            std::copy_n(mixed.begin() + (pixel - seed % std::min<size_t>(pixel, 8) - 1) * 4, 4, mixed.begin() + i);
+            continue;
+        }
+        auto step = pixel % 3 == 0 ? 1 : pixel % 3 == 1 ? 20 : 120;
+        for (size_t c = 0; c < 3; c++) mixed[i + c] = (pixel > 0 ? mixed[i + c - 4] : 0) + (seed >> (8 * c)) % step;
+        mixed[i + 3] = pixel % 11 == 0 ? seed >> 24 : 255;
+    }
+    success &= roundTripQOI("mixed", mixed, 37, 29);
+
+    return success;
+}
+
 int main(int argc, char** argv) {
     try {
+        if (!testQOI()) return 1;
+
         if (argc < 2) {
             std::cout << "Usage: " << argv[0] << " <folder_path>" << std::endl;
             return 0;
@@ -19,7 +79,7 @@ int main(int argc, char** argv) {
 
         for (auto& entry : std::filesystem::directory_iterator(folderString)) {
             auto& path = entry.path();
-            if (!entry.is_regular_file() || path.extension() != ".png") continue;
+            if (!entry.is_regular_file() || (path.extension() != ".png" && path.extension() != ".qoi")) continue;
 
             auto frameName = path.filename().string();
             auto frameResult = packer.frame(frameName, path);